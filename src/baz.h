@@ -10,7 +10,7 @@
 #define panic(msg)                                                             \
   do {                                                                         \
     print_msg_with_loc(__FILE__, __LINE__, msg, strlen(msg));                  \
-    sys_exit(1);                                                               \
+    sys_exit_group(1);                                                         \
     __builtin_unreachable();                                                   \
   } while (0)
 
@@ -19,7 +19,7 @@
     if (unlikely(!(cond))) {                                                   \
       const char *msg = "Assertion failed";                                    \
       print_msg_with_loc(__FILE__, __LINE__, msg, strlen(msg));                \
-      sys_exit(1);                                                             \
+      sys_exit_group(1);                                                       \
     }                                                                          \
   } while (0)
 
@@ -27,7 +27,7 @@
   do {                                                                         \
     if (unlikely(!(cond))) {                                                   \
       print_msg_with_loc(__FILE__, __LINE__, msg, strlen(msg));                \
-      sys_exit(1);                                                             \
+      sys_exit_group(1);                                                       \
     }                                                                          \
   } while (0)
 
@@ -64,13 +64,22 @@ _Static_assert(sizeof(i32) == 4, "i32 should be 4 byte");
 typedef long i64;
 _Static_assert(sizeof(i64) == 8, "i64 should be 8 byte");
 
+typedef unsigned __int128 u128;
+_Static_assert(sizeof(u128) == 16, "u128 should be 16 byte");
+typedef __int128 i128;
+_Static_assert(sizeof(i128) == 16, "i128 should be 16 byte");
+
 typedef i64 isize;
 typedef u64 usize;
 
 #define UINT8_MAX 255
 #define UINT16_MAX 65535
 #define UINT32_MAX 4294967295
-#define UINT64_MAX 18446744073709551615L
+#define UINT64_MAX 18446744073709551615UL
+
+#define INT32_MAX 2147483647
+#define INT64_MAX 9223372036854775807L
+#define INT64_MIN (-INT64_MAX - 1)
 
 ///////////////////////////////////////////////////////////////////////////////
 // Syscalls
@@ -80,10 +89,45 @@ typedef u64 usize;
 #define STDERR 2
 #define O_RDONLY 0
 #define SEEK_END 2
+#define PROT_NONE 0x0
 #define PROT_READ 0x1
 #define PROT_WRITE 0x2
+#define PROT_EXEC 0x4
 #define MAP_PRIVATE 0x02
 #define MAP_ANONYMOUS 0x20
+#define CLOCK_MONOTONIC 1
+#define FUTEX_WAIT 0
+#define CLONE_VM 0x00000100
+#define CLONE_FS 0x00000200
+#define CLONE_FILES 0x00000400
+#define CLONE_SIGHAND 0x00000800
+#define CLONE_THREAD 0x00010000
+#define CLONE_SYSVSEM 0x00040000
+#define CLONE_SETTLS 0x00080000
+#define CLONE_PARENT_SETTID 0x00100000
+#define CLONE_CHILD_CLEARTID 0x00200000
+#define O_WRONLY 01
+#define O_CREAT 0100
+#define O_TRUNC 01000
+#define ARCH_SET_FS 0x1002
+#define PERF_TYPE_HARDWARE 0
+#define PERF_TYPE_SOFTWARE 1
+#define PERF_TYPE_HW_CACHE 3
+#define PERF_FORMAT_GROUP 0x8
+#define PERF_ATTR_EXCLUDE_KERNEL (1 << 5)
+#define PERF_ATTR_EXCLUDE_HV (1 << 6)
+
+isize sys_read(i32 fd, void *buf, usize size) {
+  register i64 rax __asm__("rax") = 0;
+  register i32 rdi __asm__("rdi") = fd;
+  register void *rsi __asm__("rsi") = buf;
+  register usize rdx __asm__("rdx") = size;
+  __asm__ __volatile__("syscall"
+                       : "+r"(rax)
+                       : "r"(rdi), "r"(rsi), "r"(rdx)
+                       : "rcx", "r11", "memory");
+  return rax;
+}
 
 isize sys_write(i32 fd, const void *buf, usize size) {
   register i64 rax __asm__("rax") = 1;
@@ -138,6 +182,132 @@ void *sys_mmap(void *addr, usize length, i32 prot, i32 flags, i32 fd,
   return (void *)rax;
 }
 
+isize sys_munmap(void *addr, usize length) {
+  register i64 rax __asm__("rax") = 11;
+  register void *rdi __asm__("rdi") = addr;
+  register usize rsi __asm__("rsi") = length;
+  __asm__ __volatile__("syscall"
+                       : "+r"(rax)
+                       : "r"(rdi), "r"(rsi)
+                       : "rcx", "r11", "memory");
+  return rax;
+}
+
+isize sys_mprotect(void *addr, usize length, i32 prot) {
+  register i64 rax __asm__("rax") = 10;
+  register void *rdi __asm__("rdi") = addr;
+  register usize rsi __asm__("rsi") = length;
+  register i32 rdx __asm__("rdx") = prot;
+  __asm__ __volatile__("syscall"
+                       : "+r"(rax)
+                       : "r"(rdi), "r"(rsi), "r"(rdx)
+                       : "rcx", "r11", "memory");
+  return rax;
+}
+
+typedef struct {
+  i64 tv_sec;
+  i64 tv_nsec;
+} Timespec;
+
+isize sys_clock_gettime(i32 clock_id, Timespec *tp) {
+  register i64 rax __asm__("rax") = 228;
+  register i32 rdi __asm__("rdi") = clock_id;
+  register Timespec *rsi __asm__("rsi") = tp;
+  __asm__ __volatile__("syscall"
+                       : "+r"(rax)
+                       : "r"(rdi), "r"(rsi)
+                       : "rcx", "r11", "memory");
+  return rax;
+}
+
+// Monotonic clock in nanoseconds, for benchmarks
+private
+u64 time_ns(void) {
+  Timespec ts = {0};
+  sys_clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64)ts.tv_sec * 1000000000 + (u64)ts.tv_nsec;
+}
+
+// Benchmark and test inputs are generated from a fixed seed, so they are the
+// same on every run
+#define RAND_SEED 0x2545f4914f6cdd1d
+
+// xorshift64, the state must not be 0
+private
+inline u64 rand_next(u64 *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+isize sys_futex(volatile i32 *addr, i32 op, i32 val, const Timespec *timeout) {
+  register i64 rax __asm__("rax") = 202;
+  register volatile i32 *rdi __asm__("rdi") = addr;
+  register i32 rsi __asm__("rsi") = op;
+  register i32 rdx __asm__("rdx") = val;
+  register const Timespec *r10 __asm__("r10") = timeout;
+  __asm__ __volatile__("syscall"
+                       : "+r"(rax)
+                       : "r"(rdi), "r"(rsi), "r"(rdx), "r"(r10)
+                       : "rcx", "r11", "memory");
+  return rax;
+}
+
+isize sys_sched_getaffinity(i32 pid, usize size, u8 *mask) {
+  register i64 rax __asm__("rax") = 204;
+  register i32 rdi __asm__("rdi") = pid;
+  register usize rsi __asm__("rsi") = size;
+  register u8 *rdx __asm__("rdx") = mask;
+  __asm__ __volatile__("syscall"
+                       : "+r"(rax)
+                       : "r"(rdi), "r"(rsi), "r"(rdx)
+                       : "rcx", "r11", "memory");
+  return rax;
+}
+
+isize sys_arch_prctl(i32 code, usize addr) {
+  register i64 rax __asm__("rax") = 158;
+  register i32 rdi __asm__("rdi") = code;
+  register usize rsi __asm__("rsi") = addr;
+  __asm__ __volatile__("syscall"
+                       : "+r"(rax)
+                       : "r"(rdi), "r"(rsi)
+                       : "rcx", "r11", "memory");
+  return rax;
+}
+
+// The first version of struct perf_event_attr (PERF_ATTR_SIZE_VER0)
+typedef struct {
+  u32 type;
+  u32 size;
+  u64 config;
+  u64 sample_period;
+  u64 sample_type;
+  u64 read_format;
+  u64 flags;
+  u32 wakeup_events;
+  u32 bp_type;
+  u64 config1;
+} PerfEventAttr;
+
+i32 sys_perf_event_open(const PerfEventAttr *attr, i32 pid, i32 cpu,
+                        i32 group_fd, usize flags) {
+  register i64 rax __asm__("rax") = 298;
+  register const PerfEventAttr *rdi __asm__("rdi") = attr;
+  register i32 rsi __asm__("rsi") = pid;
+  register i32 rdx __asm__("rdx") = cpu;
+  register i32 r10 __asm__("r10") = group_fd;
+  register usize r8 __asm__("r8") = flags;
+  __asm__ __volatile__("syscall"
+                       : "+r"(rax)
+                       : "r"(rdi), "r"(rsi), "r"(rdx), "r"(r10), "r"(r8)
+                       : "rcx", "r11", "memory");
+  return (i32)rax;
+}
+
+// Exits the calling thread only (not exit_group)
 void sys_exit(i32 exit_status) {
   register i64 rax __asm__("rax") = 60;
   register i32 rdi __asm__("rdi") = exit_status;
@@ -148,6 +318,17 @@ void sys_exit(i32 exit_status) {
   __builtin_unreachable();
 }
 
+// Exits every thread of the process, for panics and the end of main
+void sys_exit_group(i32 exit_status) {
+  register i64 rax __asm__("rax") = 231;
+  register i32 rdi __asm__("rdi") = exit_status;
+  __asm__ __volatile__("syscall"
+                       : "+r"(rax)
+                       : "r"(rdi)
+                       : "rcx", "r11", "memory");
+  __builtin_unreachable();
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Entry point
 
@@ -156,16 +337,197 @@ int main(void);
 static usize _start_argc;
 static char const *const *_start_argv;
 
+// Data of the calling thread, which the fs segment points to (for the main
+// thread from _start, for the others from Thread_spawn)
+typedef struct ThreadLocal {
+  struct ThreadLocal *self;
+  u32 index;   // 0 for the main thread, else its slot (see Thread_spawn)
+  void *trace; // TraceBuffer, once the thread records trace events
+} ThreadLocal;
+
+static ThreadLocal _start_local;
+
+static inline ThreadLocal *thread_local(void) {
+  ThreadLocal *local;
+  __asm__("mov %%fs:0, %0" : "=r"(local));
+  return local;
+}
+
+// Functions to run once main returns, such as reports
+#define AT_EXIT_MAX 8
+static void (*_start_at_exit[AT_EXIT_MAX])(void);
+static usize _start_at_exit_len;
+
+// Kept out of _start, whose stack layout the offsets below depend on
+__attribute__((noinline)) static void _start_init(void) {
+  _start_local.self = &_start_local;
+  sys_arch_prctl(ARCH_SET_FS, (usize)&_start_local);
+}
+
+__attribute__((noinline)) static void _start_exit(int ret) {
+  for (usize i = 0; i < _start_at_exit_len; i++) {
+    _start_at_exit[i]();
+  }
+
+  sys_exit_group(ret);
+}
+
 __attribute__((force_align_arg_pointer)) void _start() {
   // Not sure why the extra offsets, it looks like both GCC and Clang push a
   // couple values to the stack before getting here. I hope it's reliable
   __asm__ __volatile__("mov 16(%%rsp), %0" : "=r"(_start_argc)::);
   __asm__ __volatile__("lea 24(%%rsp), %0" : "=r"(_start_argv)::);
 
+  _start_init();
   int ret = main();
-  sys_exit(ret);
+  _start_exit(ret);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Profiling
+
+// Hot path counters, which compile to nothing unless built with -DBAZ_PROFILE
+// (make PROFILE=1). Each counter is registered by name on first use, call
+// sites cache it in a static:
+//   - PROF_COUNT(name) counts events
+//   - PROF_SCOPE(name) counts entries to the enclosing scope and their rdtsc
+//     cycles
+//   - PROF_VALUE(name, x) keeps a log2 histogram, the mean and the max of x
+//   - PROF_LEVEL(name, x, capacity) keeps the peak of x against capacity
+// The container macros are instrumented this way, per instantiation. Counters
+// are shared by all the threads, so registration takes a lock and updates are
+// atomic. Once main returns the counters are dumped to stderr, sorted by
+// cycles then count.
+
+#ifdef BAZ_PROFILE
+
+#define PROF_MAX 256
+#define PROF_BUCKETS 16
+
+typedef struct {
+  const char *name;
+  u64 count;
+  u64 cycles;
+  u64 sum;
+  u64 max;
+  u64 capacity;
+  u64 hist[PROF_BUCKETS]; // hist[b] counts values in [2^b - 1, 2^(b+1) - 1)
+} ProfCounter;
+
+static ProfCounter _prof[PROF_MAX + 1];
+static usize _prof_len;
+static u32 _prof_lock;
+
+static void Prof_dump(void);
+static void at_exit(void (*func)(void));
+
+// Counters past PROF_MAX share the last slot
+static ProfCounter *Prof_counter(const char *name) {
+  while (__atomic_exchange_n(&_prof_lock, 1, __ATOMIC_ACQUIRE)) {
+    __builtin_ia32_pause();
+  }
+
+  ProfCounter *counter = NULL;
+  for (usize i = 0; counter == NULL && i < _prof_len; i++) {
+    const char *a = _prof[i].name;
+    const char *b = name;
+    while (*a != '\0' && *a == *b) {
+      a++;
+      b++;
+    }
+    if (*a == *b) {
+      counter = &_prof[i];
+    }
+  }
+
+  if (counter == NULL) {
+    if (_prof_len == 0) {
+      at_exit(Prof_dump);
+    }
+
+    if (_prof_len == PROF_MAX) {
+      _prof[PROF_MAX].name = "(overflow)";
+      counter = &_prof[PROF_MAX];
+    } else {
+      _prof[_prof_len].name = name;
+      counter = &_prof[_prof_len++];
+    }
+  }
+
+  __atomic_store_n(&_prof_lock, 0, __ATOMIC_RELEASE);
+  return counter;
+}
+
+static inline u64 Prof_rdtsc(void) { return __builtin_ia32_rdtsc(); }
+
+static inline void Prof_add(u64 *x, u64 y) {
+  __atomic_fetch_add(x, y, __ATOMIC_RELAXED);
+}
+
+static inline void Prof_max(u64 *x, u64 y) {
+  u64 old = __atomic_load_n(x, __ATOMIC_RELAXED);
+  while (y > old && !__atomic_compare_exchange_n(x, &old, y, true,
+                                                 __ATOMIC_RELAXED,
+                                                 __ATOMIC_RELAXED)) {
+  }
+}
+
+static inline void Prof_value(ProfCounter *counter, u64 x) {
+  usize bucket = (usize)(63 - __builtin_clzll(x + 1));
+  Prof_add(&counter->count, 1);
+  Prof_add(&counter->sum, x);
+  Prof_max(&counter->max, x);
+  Prof_add(&counter->hist[bucket < PROF_BUCKETS ? bucket : PROF_BUCKETS - 1],
+           1);
+}
+
+typedef struct {
+  ProfCounter *counter;
+  u64 start;
+} ProfScope;
+
+static inline void Prof_scope_end(ProfScope *scope) {
+  Prof_add(&scope->counter->count, 1);
+  Prof_add(&scope->counter->cycles, Prof_rdtsc() - scope->start);
 }
 
+#define PROF_CAT_(a, b) a##b
+#define PROF_CAT(a, b) PROF_CAT_(a, b)
+
+#define PROF_COUNTER(name)                                                     \
+  ({                                                                           \
+    static ProfCounter *PROF_site;                                             \
+    ProfCounter *PROF_counter = __atomic_load_n(&PROF_site, __ATOMIC_ACQUIRE); \
+    if (PROF_counter == NULL) {                                                \
+      PROF_counter = Prof_counter(name);                                       \
+      __atomic_store_n(&PROF_site, PROF_counter, __ATOMIC_RELEASE);            \
+    }                                                                          \
+    PROF_counter;                                                              \
+  })
+
+#define PROF_COUNT(name) Prof_add(&PROF_COUNTER(name)->count, 1)
+#define PROF_SCOPE(name)                                                       \
+  __attribute__((cleanup(Prof_scope_end))) ProfScope PROF_CAT(                 \
+      PROF_scope_, __LINE__) = {.counter = PROF_COUNTER(name),                 \
+                                .start = Prof_rdtsc()}
+#define PROF_VALUE(name, x) Prof_value(PROF_COUNTER(name), (u64)(x))
+#define PROF_LEVEL(name, x, cap)                                               \
+  ({                                                                           \
+    ProfCounter *PROF_level = PROF_COUNTER(name);                              \
+    Prof_add(&PROF_level->count, 1);                                           \
+    Prof_max(&PROF_level->max, (u64)(x));                                      \
+    __atomic_store_n(&PROF_level->capacity, (u64)(cap), __ATOMIC_RELAXED);     \
+  })
+
+#else
+
+#define PROF_COUNT(name) ((void)0)
+#define PROF_SCOPE(name) ((void)0)
+#define PROF_VALUE(name, x) ((void)0)
+#define PROF_LEVEL(name, x, cap) ((void)0)
+
+#endif // BAZ_PROFILE
+
 ///////////////////////////////////////////////////////////////////////////////
 // Mem utils
 
@@ -195,8 +557,83 @@ extern void *memset(void *s, int c, usize bytes) {
   return s;
 }
 
+// 128-bit long division, only uses 64-bit division itself
+static u128 udivmod128(u128 n, u128 d, u128 *rem) {
+  if (d == 0) {
+    __builtin_trap();
+  }
+
+  if ((n >> 64) == 0 && (d >> 64) == 0) {
+    *rem = (u128)((u64)n % (u64)d);
+    return (u128)((u64)n / (u64)d);
+  }
+
+  if (d > n) {
+    *rem = n;
+    return 0;
+  }
+
+  u64 n_hi = (u64)(n >> 64);
+  u64 d_hi = (u64)(d >> 64);
+  i32 n_clz = n_hi ? __builtin_clzl(n_hi) : 64 + __builtin_clzl((u64)n);
+  i32 d_clz = d_hi ? __builtin_clzl(d_hi) : 64 + __builtin_clzl((u64)d);
+  i32 shift = d_clz - n_clz;
+
+  d <<= shift;
+  u128 q = 0;
+  for (; shift >= 0; shift--) {
+    q <<= 1;
+    if (n >= d) {
+      n -= d;
+      q |= 1;
+    }
+    d >>= 1;
+  }
+
+  *rem = n;
+  return q;
+}
+
+// Needed by C compiler for 128-bit division
+extern u128 __udivti3(u128 n, u128 d) {
+  u128 rem;
+  return udivmod128(n, d, &rem);
+}
+
+extern u128 __umodti3(u128 n, u128 d) {
+  u128 rem;
+  udivmod128(n, d, &rem);
+  return rem;
+}
+
+extern i128 __divti3(i128 n, i128 d) {
+  u128 rem;
+  u128 q = udivmod128(n < 0 ? -(u128)n : (u128)n, d < 0 ? -(u128)d : (u128)d,
+                      &rem);
+  return (i128)((n < 0) != (d < 0) ? -q : q);
+}
+
+extern i128 __modti3(i128 n, i128 d) {
+  u128 rem;
+  udivmod128(n < 0 ? -(u128)n : (u128)n, d < 0 ? -(u128)d : (u128)d, &rem);
+  return (i128)(n < 0 ? -rem : rem);
+}
+
+extern u128 __udivmodti4(u128 n, u128 d, u128 *rem) {
+  return udivmod128(n, d, rem);
+}
+
+extern i128 __divmodti4(i128 n, i128 d, i128 *rem) {
+  u128 urem;
+  u128 q = udivmod128(n < 0 ? -(u128)n : (u128)n, d < 0 ? -(u128)d : (u128)d,
+                      &urem);
+  *rem = (i128)(n < 0 ? -urem : urem);
+  return (i128)((n < 0) != (d < 0) ? -q : q);
+}
+
 private
 void *calloc(usize n_elem, usize size_elem) {
+  PROF_VALUE("calloc.bytes", n_elem * size_elem);
   return sys_mmap(NULL, n_elem * size_elem, PROT_READ | PROT_WRITE,
                   MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
 }
@@ -331,6 +768,31 @@ usize fmt_u64(u8 *buf, usize buf_len, u64 x, u8 base) {
   return i;
 }
 
+private
+usize fmt_u128(u8 *buf, usize buf_len, u128 x, u8 base) {
+  if (x <= UINT64_MAX) {
+    return fmt_u64(buf, buf_len, (u64)x, base);
+  }
+
+  // write in reverse, as fmt_u64
+  usize i = 0;
+  while (x > 0) {
+    assert(i < buf_len); // crash otherwise
+
+    buf[i] = to_digit((u64)(x % base), base);
+    x /= base;
+    i++;
+  }
+
+  for (usize j = 0; j < i / 2; j++) {
+    u8 t = buf[j];
+    buf[j] = buf[i - 1 - j];
+    buf[i - 1 - j] = t;
+  }
+
+  return i;
+}
+
 private
 usize fmt_i64(u8 *buf, usize buf_len, i64 x, u8 base) {
   if (x < 0) {
@@ -372,6 +834,125 @@ i64 parse_i64(const u8 *buf, usize *buf_len, u8 base) {
   }
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Threads
+
+#define THREAD_STACK (1024 * 1024)
+
+typedef struct {
+  void (*func)(void *);
+  void *arg;
+  // Set by the kernel on spawn, cleared (with a futex wake) on exit
+  volatile i32 tid;
+  ThreadLocal local;
+  u8 *stack;
+} Thread;
+
+// Live threads hold a slot, reused once they are joined, so that per-thread
+// data (like trace buffers) is bounded by the threads alive at once rather
+// than the threads ever spawned. Slot 0 is the main thread
+#define THREAD_SLOTS 256
+#define THREAD_NO_SLOT THREAD_SLOTS
+static u64 _thread_slots[THREAD_SLOTS / 64] = {1};
+
+// Lowest free slot, or THREAD_NO_SLOT when all are taken
+static u32 Thread_slot_take(void) {
+  for (usize w = 0; w < THREAD_SLOTS / 64; w++) {
+    u64 word = __atomic_load_n(&_thread_slots[w], __ATOMIC_RELAXED);
+    while (~word != 0) {
+      u64 bit = ~word & (word + 1);
+      if (__atomic_compare_exchange_n(&_thread_slots[w], &word, word | bit,
+                                      true, __ATOMIC_ACQUIRE,
+                                      __ATOMIC_RELAXED)) {
+        return (u32)(64 * w + (usize)__builtin_ctzll(bit));
+      }
+    }
+  }
+
+  return THREAD_NO_SLOT;
+}
+
+static void Thread_slot_give(u32 slot) {
+  if (slot != THREAD_NO_SLOT) {
+    __atomic_fetch_and(&_thread_slots[slot / 64], ~((u64)1 << (slot % 64)),
+                       __ATOMIC_RELEASE);
+  }
+}
+
+static void Thread_entry(Thread *thread) {
+  thread->func(thread->arg);
+  sys_exit(0);
+}
+
+// Run func(arg) on a new thread sharing the address space. The Thread must
+// stay alive until joined
+private
+void Thread_spawn(Thread *thread, void (*func)(void *), void *arg) {
+  thread->func = func;
+  thread->arg = arg;
+  thread->local = (ThreadLocal){
+      .self = &thread->local,
+      .index = Thread_slot_take(),
+  };
+
+  // The child starts on a fresh stack with the Thread at its (16-byte
+  // aligned) top, and never returns from here
+  u8 *stack = (u8 *)calloc(THREAD_STACK, 1);
+  thread->stack = stack;
+  Thread **top = (Thread **)(stack + THREAD_STACK - 16);
+  *top = thread;
+
+  register i64 rax __asm__("rax") = 56;
+  register usize rdi __asm__("rdi") =
+      CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND | CLONE_THREAD |
+      CLONE_SYSVSEM | CLONE_SETTLS | CLONE_PARENT_SETTID | CLONE_CHILD_CLEARTID;
+  register Thread **rsi __asm__("rsi") = top;
+  register volatile i32 *rdx __asm__("rdx") = &thread->tid;
+  register volatile i32 *r10 __asm__("r10") = &thread->tid;
+  register ThreadLocal *r8 __asm__("r8") = &thread->local;
+  register void (*r9)(Thread *) __asm__("r9") = Thread_entry;
+  __asm__ __volatile__("syscall\n"
+                       "test %%rax, %%rax\n"
+                       "jnz 1f\n"
+                       "mov (%%rsp), %%rdi\n"
+                       "call *%%r9\n"
+                       "1:\n"
+                       : "+r"(rax)
+                       : "r"(rdi), "r"(rsi), "r"(rdx), "r"(r10), "r"(r8),
+                         "r"(r9)
+                       : "rcx", "r11", "memory");
+  assert(rax > 0);
+}
+
+// Waits for the thread to exit, then releases its stack (the kernel clears the
+// tid once the thread is done with it) and its slot
+private
+void Thread_join(Thread *thread) {
+  i32 tid = thread->tid;
+  while (tid != 0) {
+    sys_futex(&thread->tid, FUTEX_WAIT, tid, NULL);
+    tid = thread->tid;
+  }
+
+  isize ret = sys_munmap(thread->stack, THREAD_STACK);
+  assert(ret == 0);
+  Thread_slot_give(thread->local.index);
+}
+
+// Number of CPUs this process may run on
+private
+usize cpu_count(void) {
+  u8 mask[128] = {0};
+  isize len = sys_sched_getaffinity(0, sizeof(mask), mask);
+  assert(len > 0);
+
+  usize count = 0;
+  for (isize i = 0; i < len; i++) {
+    count += (usize)__builtin_popcount(mask[i]);
+  }
+  return count;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Basic IO
 
@@ -391,6 +972,13 @@ void putu64(u64 x) {
   sys_write(STDOUT, buf, len);
 }
 
+private
+void putu128(u128 x) {
+  u8 buf[128];
+  usize len = fmt_u128(buf, 128, x, 10);
+  sys_write(STDOUT, buf, len);
+}
+
 private
 void puti64(i64 x) {
   u8 buf[128];
@@ -398,6 +986,13 @@ void puti64(i64 x) {
   sys_write(STDOUT, buf, len);
 }
 
+// Run func once main returns, see _start
+private
+void at_exit(void (*func)(void)) {
+  assert(_start_at_exit_len < AT_EXIT_MAX);
+  _start_at_exit[_start_at_exit_len++] = func;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Int utils
 
@@ -422,6 +1017,26 @@ inline u16 u64_to_u16(u64 x) {
     x > y ? x - y : y - x;                                                     \
   })
 
+// Integer square root (floor). The x87 fsqrt has a 64-bit mantissa, so its
+// estimate is off by at most one, which is then corrected exactly
+private
+u64 isqrt(u128 x) {
+  long double estimate = (long double)(u64)(x >> 64) * 18446744073709551616.0L +
+                         (long double)(u64)x;
+  long double root;
+  __asm__("fsqrt" : "=t"(root) : "0"(estimate));
+
+  u64 r = root >= 18446744073709551615.0L ? UINT64_MAX : (u64)root;
+  while ((u128)r * r > x) {
+    r--;
+  }
+  while (r < UINT64_MAX && (u128)(r + 1) * (r + 1) <= x) {
+    r++;
+  }
+
+  return r;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Hash
 
@@ -510,6 +1125,7 @@ private                                                                        \
     T *slot = &array->dat[array->len];                                         \
     *slot = x;                                                                 \
     array->len += 1;                                                           \
+    PROF_LEVEL(#A_NAME ".len", array->len, N);                                 \
     return slot;                                                               \
   }                                                                            \
                                                                                \
@@ -519,6 +1135,7 @@ private                                                                        \
     assert_msg(ix <= array->len, "insert: ix out of bound");                   \
                                                                                \
     array->len += 1;                                                           \
+    PROF_LEVEL(#A_NAME ".len", array->len, N);                                 \
     for (usize i = ix; i < array->len; i++) {                                  \
       T t = array->dat[i];                                                     \
       array->dat[i] = x;                                                       \
@@ -621,6 +1238,12 @@ private                                                                        \
 ////////////////////////////////////////////////////////////////////////////////
 // Binary Heap
 
+// Level of ix in a heap laid out as an array, the root is at level 0
+private
+inline usize heap_level(usize ix) {
+  return (usize)(63 - __builtin_clzll((u64)ix + 1));
+}
+
 // A Max Heap
 // COMP_FUN of the shape: int cmp(const T *a, const T *b);
 // comparison function which returns​a negative integer value if the first
@@ -635,45 +1258,41 @@ private                                                                        \
   /* Implementation from https://en.wikipedia.org/wiki/Binary_heap#Insert */   \
 private                                                                        \
   void B_NAME##_insert(B_NAME *binary_heap, T x) {                             \
+    PROF_SCOPE(#B_NAME ".insert");                                             \
     /* Add the element to the bottom level of the heap at the leftmost open    \
      * space. */                                                               \
     assert(binary_heap->len < N);                                              \
     usize ix = binary_heap->len;                                               \
     binary_heap->dat[ix] = x;                                                  \
     binary_heap->len += 1;                                                     \
-                                                                               \
-    if (binary_heap->len == 1) {                                               \
-      return;                                                                  \
-    }                                                                          \
+    PROF_LEVEL(#B_NAME ".len", binary_heap->len, N);                           \
                                                                                \
     /* Compare the added element with its parent; if they are in the correct   \
      * order, stop. */                                                         \
-    usize parent = (ix - 1) / 2;                                               \
-                                                                               \
-    while (true) {                                                             \
+    usize start = ix;                                                          \
+    while (ix > 0) {                                                           \
+      usize parent = (ix - 1) / 2;                                             \
       int cmp = COMP_FUN(&binary_heap->dat[parent], &binary_heap->dat[ix]);    \
                                                                                \
       if (cmp >= 0) {                                                          \
-        return;                                                                \
+        break;                                                                 \
       }                                                                        \
                                                                                \
       /* If not, swap the element with its parent and return to the previous   \
        * step. */                                                              \
       swap(&binary_heap->dat[ix], &binary_heap->dat[parent], sizeof(T));       \
-                                                                               \
       ix = parent;                                                             \
-      if (ix == 0) {                                                           \
-        return;                                                                \
-      }                                                                        \
-                                                                               \
-      parent = (ix - 1) / 2;                                                   \
     }                                                                          \
+                                                                               \
+    PROF_VALUE(#B_NAME ".sift_up", heap_level(start) - heap_level(ix));        \
+    (void)start;                                                               \
   }                                                                            \
                                                                                \
   typedef Option(T) B_NAME##Extract;                                           \
   /* Implementation from https://en.wikipedia.org/wiki/Binary_heap#Extract */  \
 private                                                                        \
   B_NAME##Extract B_NAME##_extract(B_NAME *binary_heap) {                      \
+    PROF_SCOPE(#B_NAME ".extract");                                            \
     /* Initialise as not valid */                                              \
     B_NAME##Extract ret = {                                                    \
         .valid = false,                                                        \
@@ -698,7 +1317,7 @@ private                                                                        \
     while (true) {                                                             \
       /* No left child, we're done */                                          \
       if (ix * 2 + 1 >= binary_heap->len) {                                    \
-        return ret;                                                            \
+        break;                                                                 \
       }                                                                        \
                                                                                \
       int cmp_l =                                                              \
@@ -709,8 +1328,9 @@ private                                                                        \
         if (cmp_l < 0) {                                                       \
           swap(&binary_heap->dat[ix], &binary_heap->dat[ix * 2 + 1],           \
                sizeof(T));                                                     \
+          ix = ix * 2 + 1;                                                     \
         }                                                                      \
-        return ret;                                                            \
+        break;                                                                 \
       }                                                                        \
                                                                                \
       int cmp_r =                                                              \
@@ -719,7 +1339,7 @@ private                                                                        \
       /* Compare the new root with its children; if they are in the correct    \
        * order, stop. */                                                       \
       if (cmp_l >= 0 && cmp_r >= 0) {                                          \
-        return ret;                                                            \
+        break;                                                                 \
       }                                                                        \
                                                                                \
       /* If not, swap the element with one of its children and return to the   \
@@ -738,6 +1358,9 @@ private                                                                        \
         ix = ix * 2 + 1;                                                       \
       }                                                                        \
     }                                                                          \
+                                                                               \
+    PROF_VALUE(#B_NAME ".sift_down", heap_level(ix));                          \
+    return ret;                                                                \
   }                                                                            \
                                                                                \
   void REQUIRE_SEMICOLON()
@@ -801,6 +1424,18 @@ bool Span_match(const Span *x, const char *ref) {
   return Span_eq(x, &y);
 }
 
+// Was arg passed on the command line (such as "--bench")
+private
+bool has_arg(const char *arg) {
+  for (usize i = 1; i < _start_argc; i++) {
+    Span x = Span_from_str(_start_argv[i]);
+    if (Span_match(&x, arg)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 // Slice x[from..to] which is inclusive from and exclusive to
 private
 Span Span_slice(Span x, usize from, usize to) {
@@ -953,6 +1588,7 @@ SpanSplitIterator Span_split_words(Span x) {
 typedef Option(Span) SpanSplitIteratorNext;
 private
 SpanSplitIteratorNext SpanSplitIterator_next(SpanSplitIterator *it) {
+  PROF_COUNT("SpanSplitIterator_next");
   if (it->rest.len == 0) {
     return (SpanSplitIteratorNext){
         .valid = false,
@@ -986,26 +1622,537 @@ void SpanSplitIterator_skip(SpanSplitIterator *it, usize count) {
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// HashMap
+// Record scanning
+
+// A scanf for line formats such as "Game 12: 3 blue, 4 red". A Scanner is a
+// cursor over a Span, each scan call matches a format from it:
+//   - any byte other than % has to be there as is
+//   - %u parses an unsigned decimal into a u8, u16, u32 or u64 (by arg size)
+//   - %i parses a signed decimal into a i8, i16, i32 or i64
+//   - %w takes a word (letters and digits) into a Span
+//   - %>c skips past the next byte c
+//   - %% matches a %
+// A format is compiled once with ScanFormat_new, outside of the loop over the
+// records, into a list of fields with the literal runs already measured.
+// Repetitions are driven by the caller with Scanner_more, which takes a
+// separator if there is one.
+//
+// A scan returns false when the input doesn't match, the cursor then stays at
+// the start of the failing field (or literal run). Formats and args not
+// fitting each other are bugs and panic.
 
-// Define a hash_map with N elements, keys K, values V
-// K_HASH is a function: Hash func(const K *key)
-// K_EQ is a function: bool func(const K *a, const K *b)
-#define define_hash_map(H_NAME, K, V, N, K_HASH, K_EQ)                         \
-  typedef struct {                                                             \
-    usize count;                                                               \
-    bool occupied[N];                                                          \
-    K keys[N];                                                                 \
-    V values[N];                                                               \
-  } H_NAME;                                                                    \
-                                                                               \
-  const usize H_NAME##_capacity = N;                                           \
-                                                                               \
-private                                                                        \
-  usize H_NAME##_entry_ix(const H_NAME *hm, const K *key) {                    \
-    Hash hash = K_HASH(key);                                                   \
-                                                                               \
-    usize start_ix = hash % N;                                                 \
+typedef struct {
+  const u8 *at;
+  const u8 *end;
+} Scanner;
+
+typedef struct {
+  void *arg;
+  usize size;
+} ScanArg;
+
+typedef enum {
+  SCAN_LITERAL,
+  SCAN_UNSIGNED,
+  SCAN_SIGNED,
+  SCAN_WORD,
+  SCAN_SKIP,
+} ScanFieldKind;
+
+typedef struct {
+  ScanFieldKind kind;
+  const char *lit; // literal run, or the byte to skip past
+  usize len;
+} ScanField;
+
+#define SCAN_FIELDS_MAX 16
+
+// Points into the format string, which has to outlive it (string literals do)
+typedef struct {
+  ScanField fields[SCAN_FIELDS_MAX];
+  usize len;
+  usize argc;
+} ScanFormat;
+
+private
+ScanFormat ScanFormat_new(const char *fmt) {
+  ScanFormat format = {0};
+  usize i = 0;
+
+  while (fmt[i] != '\0') {
+    assert_msg(format.len < SCAN_FIELDS_MAX, "scan: fmt has too many fields");
+    ScanField *field = &format.fields[format.len++];
+
+    if (fmt[i] != '%') {
+      usize len = 0;
+      while (fmt[i + len] != '\0' && fmt[i + len] != '%') {
+        len++;
+      }
+
+      *field = (ScanField){.kind = SCAN_LITERAL, .lit = &fmt[i], .len = len};
+      i += len;
+      continue;
+    }
+
+    i++;
+    char directive = fmt[i];
+    assert_msg(directive != '\0', "scan: fmt str too short");
+    i++;
+
+    switch (directive) {
+    case '%':
+      *field = (ScanField){.kind = SCAN_LITERAL, .lit = &fmt[i - 1], .len = 1};
+      break;
+    case '>':
+      assert_msg(fmt[i] != '\0', "scan: %> needs a byte");
+      *field = (ScanField){.kind = SCAN_SKIP, .lit = &fmt[i], .len = 1};
+      i++;
+      break;
+    case 'u':
+      field->kind = SCAN_UNSIGNED;
+      format.argc++;
+      break;
+    case 'i':
+      field->kind = SCAN_SIGNED;
+      format.argc++;
+      break;
+    case 'w':
+      field->kind = SCAN_WORD;
+      format.argc++;
+      break;
+    default:
+      panic("Unexpected scan fmt char");
+    }
+  }
+
+  return format;
+}
+
+private
+inline Scanner Scanner_new(Span x) {
+  return (Scanner){
+      .at = x.dat,
+      .end = x.dat + x.len,
+  };
+}
+
+private
+inline bool Scanner_done(const Scanner *scanner) {
+  return scanner->at == scanner->end;
+}
+
+private
+inline Span Scanner_rest(const Scanner *scanner) {
+  return (Span){
+      .dat = scanner->at,
+      .len = (usize)(scanner->end - scanner->at),
+  };
+}
+
+// Take len bytes of literal if they are next. Literals are short, so this
+// compares in place rather than calling memcmp
+private
+inline bool Scanner_literal(Scanner *scanner, const char *lit, usize len) {
+  if ((usize)(scanner->end - scanner->at) < len) {
+    return false;
+  }
+
+  for (usize i = 0; i < len; i++) {
+    if (scanner->at[i] != (u8)lit[i]) {
+      return false;
+    }
+  }
+
+  scanner->at += len;
+  return true;
+}
+
+// The separator has to be a string literal, its length is then a constant
+#define Scanner_more(scanner, sep)                                             \
+  Scanner_literal(scanner, "" sep, sizeof(sep) - 1)
+
+// Digits of a u64, a value past UINT64_MAX is an error
+private
+inline bool Scanner_digits(Scanner *scanner, u64 *out) {
+  const u8 *at = scanner->at;
+
+  u64 x = 0;
+  while (at < scanner->end && (u8)(*at - '0') < 10) {
+    bool overflow = __builtin_mul_overflow(x, 10, &x);
+    overflow |= __builtin_add_overflow(x, (u64)(*at - '0'), &x);
+    assert_msg(!overflow, "scan: value out of range");
+    at++;
+  }
+
+  if (at == scanner->at) {
+    return false;
+  }
+
+  scanner->at = at;
+  *out = x;
+  return true;
+}
+
+// Store the magnitude x (negated when negative) in an int of arg.size bytes,
+// checking that it fits
+private
+void __scan_store(ScanArg arg, u64 x, bool is_signed, bool negative) {
+  usize bits = 8 * arg.size;
+  if (is_signed) {
+    u64 limit = (u64)1 << (bits - 1);
+    assert_msg(negative ? x <= limit : x < limit, "scan: value out of range");
+    x = negative ? -x : x;
+  } else if (bits < 64) {
+    assert_msg(x >> bits == 0, "scan: value out of range");
+  }
+
+  switch (arg.size) {
+  case 1:
+    *(u8 *)arg.arg = (u8)x;
+    break;
+  case 2:
+    *(u16 *)arg.arg = (u16)x;
+    break;
+  case 4:
+    *(u32 *)arg.arg = (u32)x;
+    break;
+  case 8:
+    *(u64 *)arg.arg = x;
+    break;
+  default:
+    panic("scan: unexpected arg size");
+  }
+}
+
+private
+bool __scan(Scanner *scanner, const ScanFormat *format, usize argc,
+            const ScanArg *argv) {
+  assert_msg(format->argc == argc, "scan: fmt and args don't match");
+  usize arg_ix = 0;
+
+  for (usize i = 0; i < format->len; i++) {
+    const ScanField *field = &format->fields[i];
+
+    switch (field->kind) {
+    case SCAN_LITERAL:
+      if (!Scanner_literal(scanner, field->lit, field->len)) {
+        return false;
+      }
+      break;
+    case SCAN_SKIP: {
+      const u8 *match = (const u8 *)memchr(
+          scanner->at, (u8)field->lit[0], (usize)(scanner->end - scanner->at));
+      if (match == NULL) {
+        return false;
+      }
+
+      scanner->at = match + 1;
+      break;
+    }
+    case SCAN_UNSIGNED: {
+      u64 x;
+      if (!Scanner_digits(scanner, &x)) {
+        return false;
+      }
+      __scan_store(argv[arg_ix++], x, false, false);
+      break;
+    }
+    case SCAN_SIGNED: {
+      const u8 *start = scanner->at;
+      bool negative = Scanner_literal(scanner, "-", 1);
+
+      u64 x;
+      if (!Scanner_digits(scanner, &x)) {
+        scanner->at = start;
+        return false;
+      }
+      __scan_store(argv[arg_ix++], x, true, negative);
+      break;
+    }
+    case SCAN_WORD: {
+      ScanArg arg = argv[arg_ix++];
+      assert_msg(arg.size == sizeof(Span), "scan: %w expects a Span");
+
+      const u8 *at = scanner->at;
+      while (at < scanner->end &&
+             ((u8)((*at | 0x20) - 'a') < 26 || (u8)(*at - '0') < 10)) {
+        at++;
+      }
+
+      if (at == scanner->at) {
+        return false;
+      }
+
+      *(Span *)arg.arg = (Span){
+          .dat = scanner->at,
+          .len = (usize)(at - scanner->at),
+      };
+      scanner->at = at;
+      break;
+    }
+    }
+  }
+
+  return true;
+}
+
+#define SCAN_ARG(A) ((ScanArg){.arg = (void *)(A), .size = sizeof(*(A))})
+
+#define scan0(scanner, format) __scan(scanner, format, 0, NULL)
+#define scan1(scanner, format, A)                                              \
+  __scan(scanner, format, 1, (ScanArg[]){SCAN_ARG(A)})
+#define scan2(scanner, format, A, B)                                           \
+  __scan(scanner, format, 2, (ScanArg[]){SCAN_ARG(A), SCAN_ARG(B)})
+#define scan3(scanner, format, A, B, C)                                        \
+  __scan(scanner, format, 3,                                                   \
+         (ScanArg[]){SCAN_ARG(A), SCAN_ARG(B), SCAN_ARG(C)})
+#define scan4(scanner, format, A, B, C, D)                                     \
+  __scan(scanner, format, 4,                                                   \
+         (ScanArg[]){SCAN_ARG(A), SCAN_ARG(B), SCAN_ARG(C), SCAN_ARG(D)})
+
+////////////////////////////////////////////////////////////////////////////////
+// Structural index
+
+// Stage 1 of a simdjson style parser: one AVX2 sweep over the input records a
+// bit mask per kind of byte for every 64-byte block (bit i of block b is input
+// byte 64 * b + i). Stage 2 then jumps between fields with StructIndex_next,
+// or walks every byte of a kind with StructIter_next, both using tzcnt rather
+// than going over the bytes again.
+
+typedef enum {
+  STRUCT_NEWLINE,
+  STRUCT_SPACE,
+  STRUCT_DIGIT,
+  STRUCT_CLASS, // any byte of the class given to StructIndex_new
+  STRUCT_KINDS,
+} StructKind;
+
+#define STRUCT_CLASS_MAX 8
+
+typedef struct {
+  u64 masks[STRUCT_KINDS];
+} StructBlock;
+
+typedef struct {
+  usize len; // in bytes
+  StructBlock *blocks;
+} StructIndex;
+
+typedef u8 StructBytes __attribute__((vector_size(32), aligned(1)));
+typedef char StructLanes __attribute__((vector_size(32)));
+
+private
+inline u64 StructLanes_mask(StructLanes x) {
+  return (u64)(u32)__builtin_ia32_pmovmskb256(x);
+}
+
+private
+StructIndex StructIndex_new(Span input, const char *class) {
+  usize class_len = strlen(class);
+  assert(class_len <= STRUCT_CLASS_MAX);
+
+  usize blocks = (input.len + 63) / 64;
+  StructIndex index = {
+      .len = input.len,
+      .blocks = (StructBlock *)calloc(blocks + 1, sizeof(StructBlock)),
+  };
+
+  for (usize b = 0; b < blocks; b++) {
+    // Zero padding for the last block, no kind has a 0 byte
+    u8 tail[64] = {0};
+    const u8 *dat = &input.dat[64 * b];
+    if (input.len - 64 * b < 64) {
+      memcpy(tail, dat, input.len - 64 * b);
+      dat = tail;
+    }
+
+    StructBlock *block = &index.blocks[b];
+
+    for (usize h = 0; h < 2; h++) {
+      StructBytes v = *(const StructBytes *)&dat[32 * h];
+
+      StructLanes in_class = {0};
+      for (usize c = 0; c < class_len; c++) {
+        in_class |= (StructLanes)(v == (u8)class[c]);
+      }
+
+      usize shift = 32 * h;
+      block->masks[STRUCT_NEWLINE] |= StructLanes_mask((StructLanes)(v == '\n'))
+                                      << shift;
+      block->masks[STRUCT_SPACE] |= StructLanes_mask((StructLanes)(v == ' '))
+                                    << shift;
+      block->masks[STRUCT_DIGIT] |=
+          StructLanes_mask((StructLanes)((StructBytes)(v - '0') < 10)) << shift;
+      block->masks[STRUCT_CLASS] |= StructLanes_mask(in_class) << shift;
+    }
+  }
+
+  return index;
+}
+
+// First position >= from which is (or, for value false, isn't) of the kind,
+// or the input length
+private
+usize StructIndex_next(const StructIndex *index, StructKind kind, usize from,
+                       bool value) {
+  while (from < index->len) {
+    u64 word = index->blocks[from / 64].masks[kind];
+    word = value ? word : ~word;
+    word &= ~(u64)0 << (from % 64);
+
+    if (word != 0) {
+      usize i = (from & ~(usize)63) + (usize)__builtin_ctzll(word);
+      return i < index->len ? i : index->len;
+    }
+
+    from = (from & ~(usize)63) + 64;
+  }
+
+  return index->len;
+}
+
+// All the positions of a kind, in order
+typedef struct {
+  const StructIndex *index;
+  StructKind kind;
+  usize block;
+  u64 word;
+} StructIter;
+
+private
+StructIter StructIndex_iter(const StructIndex *index, StructKind kind) {
+  return (StructIter){
+      .index = index,
+      .kind = kind,
+      .block = 0,
+      .word = index->blocks[0].masks[kind],
+  };
+}
+
+typedef Option(usize) StructIterNext;
+private
+inline StructIterNext StructIter_next(StructIter *it) {
+  while (it->word == 0) {
+    it->block++;
+    if (64 * it->block >= it->index->len) {
+      return (StructIterNext){.valid = false};
+    }
+    it->word = it->index->blocks[it->block].masks[it->kind];
+  }
+
+  usize i = 64 * it->block + (usize)__builtin_ctzll(it->word);
+  it->word &= it->word - 1;
+
+  return (StructIterNext){.valid = true, .dat = i};
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Multi-pattern matching
+
+// Aho-Corasick automaton, compiled to a DFA over byte classes (bytes that
+// appear in no pattern share class 0, which leads back to the root). Feed it
+// one byte at a time with Matcher_step, the state then tells which pattern
+// (the longest one) ends at that byte, or -1
+#define MATCHER_STATES 256
+#define MATCHER_CLASSES 64
+
+typedef struct {
+  u8 class[256];
+  u16 next[MATCHER_STATES][MATCHER_CLASSES];
+  i16 match[MATCHER_STATES];
+  usize states;
+  usize classes;
+} Matcher;
+
+private
+void Matcher_init(Matcher *matcher, const char *const *patterns, usize len) {
+  memset(matcher, 0, sizeof(Matcher));
+  matcher->states = 1;
+  matcher->classes = 1;
+  matcher->match[0] = -1;
+
+  // Trie of the patterns
+  for (usize p = 0; p < len; p++) {
+    usize state = 0;
+
+    for (const char *c = patterns[p]; *c != '\0'; c++) {
+      u8 byte = (u8)*c;
+      if (matcher->class[byte] == 0) {
+        assert(matcher->classes < MATCHER_CLASSES);
+        matcher->class[byte] = (u8)matcher->classes++;
+      }
+
+      u16 *next = &matcher->next[state][matcher->class[byte]];
+      if (*next == 0) {
+        assert(matcher->states < MATCHER_STATES);
+        matcher->match[matcher->states] = -1;
+        *next = (u16)matcher->states++;
+      }
+      state = *next;
+    }
+
+    assert(state != 0);
+    if (matcher->match[state] < 0) {
+      matcher->match[state] = (i16)p;
+    }
+  }
+
+  // Breadth first, so that the failure state (and its transitions) are
+  // complete before they are needed
+  u16 fail[MATCHER_STATES] = {0};
+  u16 queue[MATCHER_STATES];
+  usize head = 0;
+  usize tail = 0;
+  queue[tail++] = 0;
+
+  while (head < tail) {
+    u16 state = queue[head++];
+
+    for (usize c = 0; c < matcher->classes; c++) {
+      u16 child = matcher->next[state][c];
+      u16 fallback = state == 0 ? 0 : matcher->next[fail[state]][c];
+
+      if (child == 0) {
+        matcher->next[state][c] = fallback;
+        continue;
+      }
+
+      fail[child] = fallback;
+      if (matcher->match[child] < 0) {
+        matcher->match[child] = matcher->match[fallback];
+      }
+      queue[tail++] = child;
+    }
+  }
+}
+
+private
+inline u16 Matcher_step(const Matcher *matcher, u16 state, u8 byte) {
+  return matcher->next[state][matcher->class[byte]];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// HashMap
+
+// Define a hash_map with N elements, keys K, values V
+// K_HASH is a function: Hash func(const K *key)
+// K_EQ is a function: bool func(const K *a, const K *b)
+#define define_hash_map(H_NAME, K, V, N, K_HASH, K_EQ)                         \
+  typedef struct {                                                             \
+    usize count;                                                               \
+    bool occupied[N];                                                          \
+    K keys[N];                                                                 \
+    V values[N];                                                               \
+  } H_NAME;                                                                    \
+                                                                               \
+  const usize H_NAME##_capacity = N;                                           \
+                                                                               \
+private                                                                        \
+  usize H_NAME##_entry_ix(const H_NAME *hm, const K *key) {                    \
+    PROF_SCOPE(#H_NAME ".entry_ix");                                           \
+    Hash hash = K_HASH(key);                                                   \
+                                                                               \
+    usize start_ix = hash % N;                                                 \
                                                                                \
     usize ix = start_ix;                                                       \
     while (hm->occupied[ix] && !K_EQ(&hm->keys[ix], key)) {                    \
@@ -1014,6 +2161,7 @@ private                                                                        \
       assert(ix != start_ix); /* Ran out of space */                           \
     }                                                                          \
                                                                                \
+    PROF_VALUE(#H_NAME ".probe", (ix + N - start_ix) % N);                     \
     return ix;                                                                 \
   }                                                                            \
                                                                                \
@@ -1051,6 +2199,7 @@ private                                                                        \
                                                                                \
     if (!was_occupied) {                                                       \
       hm->count += 1;                                                          \
+      PROF_LEVEL(#H_NAME ".count", hm->count, N);                              \
     }                                                                          \
                                                                                \
     return was_occupied;                                                       \
@@ -1066,6 +2215,7 @@ private                                                                        \
                                                                                \
     if (!was_occupied) {                                                       \
       hm->count += 1;                                                          \
+      PROF_LEVEL(#H_NAME ".count", hm->count, N);                              \
       hm->values[ix] = def;                                                    \
     }                                                                          \
                                                                                \
@@ -1422,6 +2572,553 @@ void __printf(const char *fmt, usize argc, const PrintfArg *argv) {
                                        .size = sizeof(PRINTF_c)}});            \
   })
 
+////////////////////////////////////////////////////////////////////////////////
+// Performance counters
+
+// Counters of the calling thread from perf_event_open, read as one group
+// around named regions: Perf_phase ends the current region and starts the
+// next one (NULL to only end it). Every call starts a region of its own,
+// numbered among those of the same name, so that the example runs of a day
+// don't blur the numbers of its puzzle input.
+//
+// Off unless the program is run with --perf, then each region's totals go to
+// stderr at exit. The group is led by the task clock, a software counter, so
+// that machines without some hardware counters (such as VMs) still report
+// what they have, and n/a for the rest.
+
+typedef struct {
+  const char *name;
+  u32 type;
+  u64 config;
+} PerfCounter;
+
+// Cache events are id | op << 8 | result << 16, here reads (0) missing (1)
+// the L1D (0) and last level (2) caches
+#define PERF_COUNTERS 6
+static const PerfCounter perf_counters[PERF_COUNTERS] = {
+    {.name = "task-ns", .type = PERF_TYPE_SOFTWARE, .config = 1},
+    {.name = "cycles", .type = PERF_TYPE_HARDWARE, .config = 0},
+    {.name = "instructions", .type = PERF_TYPE_HARDWARE, .config = 1},
+    {.name = "L1D-misses", .type = PERF_TYPE_HW_CACHE, .config = 0x10000},
+    {.name = "LLC-misses", .type = PERF_TYPE_HW_CACHE, .config = 0x10002},
+    {.name = "branch-misses", .type = PERF_TYPE_HARDWARE, .config = 5},
+};
+
+#define PERF_REGIONS 64
+
+typedef struct {
+  const char *name;
+  usize nth; // among the regions of that name, from 1
+  u64 counts[PERF_COUNTERS];
+} PerfRegion;
+
+typedef struct {
+  bool init;
+  bool on;
+  i32 leader;
+  bool open[PERF_COUNTERS];
+  PerfRegion regions[PERF_REGIONS];
+  usize regions_len;
+  PerfRegion *current;
+  u64 start[PERF_COUNTERS];
+} Perf;
+
+static Perf _perf;
+
+private
+void Perf_read(u64 counts[PERF_COUNTERS]) {
+  // PERF_FORMAT_GROUP: the number of counters, then their values in the
+  // order they were opened
+  u64 buf[1 + PERF_COUNTERS] = {0};
+  assert(sys_read(_perf.leader, buf, sizeof(buf)) > 0);
+
+  usize read = 0;
+  for (usize c = 0; c < PERF_COUNTERS; c++) {
+    counts[c] = _perf.open[c] && read < buf[0] ? buf[1 + read++] : 0;
+  }
+}
+
+// End the current region, if any, with the counts read now
+private
+void Perf_end(const u64 now[PERF_COUNTERS]) {
+  if (_perf.current == NULL) {
+    return;
+  }
+
+  for (usize c = 0; c < PERF_COUNTERS; c++) {
+    _perf.current->counts[c] += now[c] - _perf.start[c];
+  }
+  _perf.current = NULL;
+}
+
+private
+void Perf_report(void) {
+  u64 now[PERF_COUNTERS];
+  Perf_read(now);
+  Perf_end(now);
+
+  String out = {0};
+
+  for (usize r = 0; r < _perf.regions_len; r++) {
+    const PerfRegion *region = &_perf.regions[r];
+
+    String_push_str(&out, "perf ");
+    String_push_str(&out, region->name);
+    String_push_str(&out, " #");
+    String_push_u64(&out, region->nth, 10);
+    String_push_str(&out, ":");
+
+    for (usize c = 0; c < PERF_COUNTERS; c++) {
+      String_push_str(&out, " ");
+      String_push_str(&out, perf_counters[c].name);
+      String_push_str(&out, " ");
+      if (_perf.open[c]) {
+        String_push_u64(&out, region->counts[c], 10);
+      } else {
+        String_push_str(&out, "n/a");
+      }
+    }
+
+    // Instructions per cycle, with two decimals
+    u64 cycles = region->counts[1];
+    if (_perf.open[1] && _perf.open[2] && cycles > 0) {
+      u64 ipc = region->counts[2] * 100 / cycles;
+      String_push_str(&out, " IPC ");
+      String_push_u64(&out, ipc / 100, 10);
+      String_push(&out, '.');
+      String_push_u64(&out, ipc / 10 % 10, 10);
+      String_push_u64(&out, ipc % 10, 10);
+    }
+
+    String_push(&out, '\n');
+    sys_write(STDERR, out.dat, out.len);
+    String_clear(&out);
+  }
+}
+
+private
+void Perf_init(void) {
+  _perf.init = true;
+  if (!has_arg("--perf")) {
+    return;
+  }
+
+  _perf.leader = -1;
+  for (usize c = 0; c < PERF_COUNTERS; c++) {
+    PerfEventAttr attr = {
+        .type = perf_counters[c].type,
+        .size = sizeof(PerfEventAttr),
+        .config = perf_counters[c].config,
+        .read_format = PERF_FORMAT_GROUP,
+        .flags = PERF_ATTR_EXCLUDE_KERNEL | PERF_ATTR_EXCLUDE_HV,
+    };
+
+    i32 fd = sys_perf_event_open(&attr, 0, -1, _perf.leader, 0);
+    if (fd < 0) {
+      continue;
+    }
+
+    _perf.open[c] = true;
+    if (_perf.leader < 0) {
+      _perf.leader = fd;
+    }
+  }
+
+  if (!_perf.open[0]) {
+    const char *msg = "perf: perf_event_open failed\n";
+    sys_write(STDERR, msg, strlen(msg));
+    return;
+  }
+
+  _perf.on = true;
+  at_exit(Perf_report);
+}
+
+private
+void Perf_phase(const char *name) {
+  if (!_perf.init) {
+    Perf_init();
+  }
+
+  if (!_perf.on) {
+    return;
+  }
+
+  u64 now[PERF_COUNTERS];
+  Perf_read(now);
+  Perf_end(now);
+
+  if (name == NULL) {
+    return;
+  }
+
+  Span name_span = Span_from_str(name);
+  usize nth = 1;
+  for (usize r = 0; r < _perf.regions_len; r++) {
+    nth += Span_match(&name_span, _perf.regions[r].name);
+  }
+
+  assert_msg(_perf.regions_len < PERF_REGIONS, "perf: too many regions");
+  _perf.current = &_perf.regions[_perf.regions_len++];
+  *_perf.current = (PerfRegion){.name = name, .nth = nth};
+  memcpy(_perf.start, now, sizeof(now));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Tracing
+
+// Begin/end events with rdtsc timestamps, for a timeline of phases and
+// threads. Each thread appends to its own buffer (found through
+// thread_local), which only it writes to, so recording takes no lock. Buffers
+// are registered by thread slot: a thread spawned into the slot of a joined one
+// carries on its buffer and timeline track. A thread without a slot has its
+// events counted as dropped.
+//
+// Off unless the program is run with --trace, then the events are written
+// as Chrome trace-event JSON to trace.json at exit, to open with
+// chrome://tracing or ui.perfetto.dev. The first call has to come from the
+// main thread, before any thread records.
+
+#define TRACE_EVENTS (64 * 1024)
+
+typedef struct {
+  const char *name; // NULL for an end
+  u64 tsc;
+} TraceEvent;
+
+typedef struct {
+  u32 thread;
+  usize len;
+  usize dropped;
+  const char *phase; // open Trace_phase region
+  TraceEvent events[TRACE_EVENTS];
+} TraceBuffer;
+
+typedef struct {
+  bool init;
+  bool on;
+  u64 start_tsc;
+  u64 start_ns;
+  usize dropped; // events of threads without a slot
+  TraceBuffer *buffers[THREAD_SLOTS];
+} Trace;
+
+static Trace _trace;
+
+private
+TraceBuffer *Trace_buffer(void) {
+  ThreadLocal *local = thread_local();
+
+  if (local->trace == NULL && local->index != THREAD_NO_SLOT) {
+    TraceBuffer *buffer = _trace.buffers[local->index];
+    if (buffer == NULL) {
+      buffer = (TraceBuffer *)calloc(1, sizeof(TraceBuffer));
+      buffer->thread = local->index;
+      _trace.buffers[local->index] = buffer;
+    }
+    local->trace = buffer;
+  }
+
+  return (TraceBuffer *)local->trace;
+}
+
+private
+inline void Trace_push(TraceBuffer *buffer, const char *name) {
+  if (buffer == NULL) {
+    __atomic_fetch_add(&_trace.dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  if (buffer->len == TRACE_EVENTS) {
+    buffer->dropped++;
+    return;
+  }
+
+  buffer->events[buffer->len++] = (TraceEvent){
+      .name = name,
+      .tsc = __builtin_ia32_rdtsc(),
+  };
+}
+
+// Timestamp in microseconds (with 3 decimals) from the rdtsc rate measured
+// over the whole run
+private
+void Trace_push_ts(String *out, u64 tsc, u64 end_tsc, u64 end_ns) {
+  u64 ticks = end_tsc - _trace.start_tsc;
+  u64 ns = ticks == 0 ? 0
+                      : (u64)((u128)(tsc - _trace.start_tsc) *
+                              (end_ns - _trace.start_ns) / ticks);
+  String_push_u64(out, ns / 1000, 10);
+  String_push(out, '.');
+  String_push(out, (u8)('0' + ns / 100 % 10));
+  String_push(out, (u8)('0' + ns / 10 % 10));
+  String_push(out, (u8)('0' + ns % 10));
+}
+
+private
+void Trace_write(void) {
+  u64 end_tsc = __builtin_ia32_rdtsc();
+  u64 end_ns = time_ns();
+
+  i32 fd = sys_open("trace.json", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    const char *msg = "trace: could not open trace.json\n";
+    sys_write(STDERR, msg, strlen(msg));
+    return;
+  }
+
+  const char *head = "{\"traceEvents\":[\n";
+  sys_write(fd, head, strlen(head));
+
+  String out = {0};
+  usize events = 0;
+  usize dropped = _trace.dropped;
+
+  for (usize t = 0; t < THREAD_SLOTS; t++) {
+    TraceBuffer *buffer = _trace.buffers[t];
+    if (buffer == NULL) {
+      continue;
+    }
+
+    // Close the phase left open, if any
+    if (buffer->phase != NULL) {
+      Trace_push(buffer, NULL);
+      buffer->phase = NULL;
+    }
+
+    String_clear(&out);
+    String_push_str(&out, events > 0 ? ",\n" : "");
+    String_push_str(&out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                          "\"tid\":");
+    String_push_u64(&out, t, 10);
+    String_push_str(&out, ",\"args\":{\"name\":\"");
+    String_push_str(&out, t == 0 ? "main" : "thread ");
+    if (t > 0) {
+      String_push_u64(&out, t, 10);
+    }
+    String_push_str(&out, "\"}}");
+    sys_write(fd, out.dat, out.len);
+    events++;
+
+    for (usize e = 0; e < buffer->len; e++) {
+      const TraceEvent *event = &buffer->events[e];
+
+      String_clear(&out);
+      String_push_str(&out, ",\n{\"ph\":\"");
+      String_push_str(&out, event->name != NULL ? "B" : "E");
+      if (event->name != NULL) {
+        String_push_str(&out, "\",\"name\":\"");
+        String_push_str(&out, event->name);
+      }
+      String_push_str(&out, "\",\"pid\":1,\"tid\":");
+      String_push_u64(&out, t, 10);
+      String_push_str(&out, ",\"ts\":");
+      Trace_push_ts(&out, event->tsc, end_tsc, end_ns);
+      String_push_str(&out, "}");
+      sys_write(fd, out.dat, out.len);
+      events++;
+    }
+
+    dropped += buffer->dropped;
+  }
+
+  const char *tail = "\n]}\n";
+  sys_write(fd, tail, strlen(tail));
+
+  String_clear(&out);
+  String_push_str(&out, "trace: ");
+  String_push_u64(&out, events, 10);
+  String_push_str(&out, " events written to trace.json");
+  if (dropped > 0) {
+    String_push_str(&out, ", ");
+    String_push_u64(&out, dropped, 10);
+    String_push_str(&out, " dropped");
+  }
+  String_push(&out, '\n');
+  sys_write(STDERR, out.dat, out.len);
+}
+
+private
+void Trace_init(void) {
+  _trace.init = true;
+  if (!has_arg("--trace")) {
+    return;
+  }
+
+  _trace.start_tsc = __builtin_ia32_rdtsc();
+  _trace.start_ns = time_ns();
+  _trace.on = true;
+  at_exit(Trace_write);
+}
+
+// Event names go to the JSON as is, so they can't have quotes or backslashes
+private
+void Trace_begin(const char *name) {
+  if (!_trace.init) {
+    Trace_init();
+  }
+
+  if (_trace.on) {
+    Trace_push(Trace_buffer(), name);
+  }
+}
+
+private
+void Trace_end(void) {
+  if (_trace.on) {
+    Trace_push(Trace_buffer(), NULL);
+  }
+}
+
+// Like Perf_phase: end the calling thread's current phase and begin the next
+// (NULL to only end it)
+private
+void Trace_phase(const char *name) {
+  if (!_trace.init) {
+    Trace_init();
+  }
+
+  if (!_trace.on) {
+    return;
+  }
+
+  TraceBuffer *buffer = Trace_buffer();
+  if (buffer == NULL) {
+    Trace_push(buffer, name);
+    return;
+  }
+
+  if (buffer->phase != NULL) {
+    Trace_push(buffer, NULL);
+  }
+
+  buffer->phase = name;
+  if (name != NULL) {
+    Trace_push(buffer, name);
+  }
+}
+
+// Mark the start of a solver phase (such as "parse", "part1" or "part2") for
+// both the performance counters and the trace, NULL ends the current one
+private
+void phase(const char *name) {
+  Perf_phase(name);
+  Trace_phase(name);
+}
+
+#ifdef BAZ_PROFILE
+
+// Right aligned in width columns
+static void Prof_push_u64(String *out, u64 x, usize width) {
+  u8 buf[32];
+  usize len = fmt_u64(buf, 32, x, 10);
+  for (usize i = len; i < width; i++) {
+    String_push(out, ' ');
+  }
+  String_push_span(out, (Span){.dat = buf, .len = len});
+}
+
+// x / 100 with two decimals
+static void Prof_push_hundredths(String *out, u64 x) {
+  String_push_u64(out, x / 100, 10);
+  String_push(out, '.');
+  String_push(out, (u8)('0' + x / 10 % 10));
+  String_push(out, (u8)('0' + x % 10));
+}
+
+static void Prof_dump(void) {
+  // Insertion sort by cycles then count, both descending
+  ProfCounter *sorted[PROF_MAX + 1];
+  usize len = _prof_len + (_prof[PROF_MAX].name != NULL);
+  for (usize i = 0; i < len; i++) {
+    ProfCounter *c = i < _prof_len ? &_prof[i] : &_prof[PROF_MAX];
+    usize j = i;
+    while (j > 0 && (sorted[j - 1]->cycles < c->cycles ||
+                     (sorted[j - 1]->cycles == c->cycles &&
+                      sorted[j - 1]->count < c->count))) {
+      sorted[j] = sorted[j - 1];
+      j--;
+    }
+    sorted[j] = c;
+  }
+
+  String out = {0};
+  String_push_str(&out, "prof: name                               count    "
+                        "   cycles  cycles/call\n");
+  sys_write(STDERR, out.dat, out.len);
+
+  for (usize i = 0; i < len; i++) {
+    const ProfCounter *c = sorted[i];
+    String_clear(&out);
+
+    String_push_str(&out, "prof: ");
+    String_push_str(&out, c->name);
+    for (usize n = strlen(c->name); n < 28; n++) {
+      String_push(&out, ' ');
+    }
+    Prof_push_u64(&out, c->count, 12);
+
+    if (c->cycles > 0) {
+      Prof_push_u64(&out, c->cycles, 13);
+      Prof_push_u64(&out, c->cycles / c->count, 13);
+    }
+
+    if (c->capacity > 0) {
+      String_push_str(&out, "  peak ");
+      String_push_u64(&out, c->max, 10);
+      String_push_str(&out, " / ");
+      String_push_u64(&out, c->capacity, 10);
+      String_push_str(&out, " (");
+      Prof_push_hundredths(&out, c->max * 10000 / c->capacity);
+      String_push_str(&out, "%)");
+    }
+
+    bool values = false;
+    for (usize b = 0; b < PROF_BUCKETS; b++) {
+      values = values || c->hist[b] > 0;
+    }
+
+    if (values) {
+      String_push_str(&out, "  mean ");
+      Prof_push_hundredths(&out, c->sum * 100 / c->count);
+      String_push_str(&out, " max ");
+      String_push_u64(&out, c->max, 10);
+    }
+
+    String_push(&out, '\n');
+    sys_write(STDERR, out.dat, out.len);
+
+    if (!values) {
+      continue;
+    }
+
+    // Histogram buckets as low-high ranges, both included
+    String_clear(&out);
+    String_push_str(&out, "prof:   ");
+    for (usize b = 0; b < PROF_BUCKETS; b++) {
+      if (c->hist[b] == 0) {
+        continue;
+      }
+
+      u64 low = ((u64)1 << b) - 1;
+      String_push(&out, ' ');
+      String_push_u64(&out, low, 10);
+      if (b == PROF_BUCKETS - 1) {
+        String_push_str(&out, "+");
+      } else if (b > 0) {
+        String_push(&out, '-');
+        String_push_u64(&out, 2 * low, 10);
+      }
+      String_push(&out, ':');
+      String_push_u64(&out, c->hist[b], 10);
+    }
+    String_push(&out, '\n');
+    sys_write(STDERR, out.dat, out.len);
+  }
+}
+
+#endif // BAZ_PROFILE
+
 // Better error message now that we can format __LINE__ properly
 static void print_msg_with_loc(const char *file, u64 line, const char *msg,
                                usize msg_len) {
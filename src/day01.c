@@ -1,14 +1,95 @@
 #include "baz.h"
 
-void solve(Span data) {
+typedef T2(u64, u64) Calibration;
+
+// Digits then their names, a pattern p stands for digit p % 9 + 1
+static const char *const digit_patterns[] = {
+    "1",   "2",   "3",     "4",    "5",    "6",   "7",     "8",     "9",
+    "one", "two", "three", "four", "five", "six", "seven", "eight", "nine",
+};
+
+// Calibration digits of the line read so far
+typedef struct {
+  u8 first;
+  u8 last;
+} Digits;
+
+static inline void Digits_see(Digits *digits, u8 digit) {
+  digits->first = digits->first ? digits->first : digit;
+  digits->last = digit ? digit : digits->last;
+}
+
+static inline u64 Digits_value(Digits digits) {
+  return (u64)(digits.first * 10 + digits.last);
+}
+
+typedef struct {
+  u8 digit1[MATCHER_STATES];
+  u8 digit2[MATCHER_STATES];
+} DigitTable;
+
+// Digit ending at each state (0 for none), so the scan has no branch on it
+static DigitTable DigitTable_new(const Matcher *matcher) {
+  DigitTable table = {0};
+
+  for (usize s = 0; s < matcher->states; s++) {
+    i16 match = matcher->match[s];
+    if (match >= 0) {
+      table.digit2[s] = (u8)(match % 9 + 1);
+      table.digit1[s] = match < 9 ? table.digit2[s] : 0;
+    }
+  }
+
+  return table;
+}
+
+typedef struct {
+  u16 state;
+  Digits line1;
+  Digits line2;
+  u64 part1;
+  u64 part2;
+} Scan;
+
+static inline void Scan_byte(Scan *scan, const Matcher *matcher,
+                             const DigitTable *table, u8 c) {
+  if (c == '\n') {
+    scan->part1 += Digits_value(scan->line1);
+    scan->part2 += Digits_value(scan->line2);
+    *scan = (Scan){.part1 = scan->part1, .part2 = scan->part2};
+    return;
+  }
+
+  scan->state = Matcher_step(matcher, scan->state, c);
+  Digits_see(&scan->line1, table->digit1[scan->state]);
+  Digits_see(&scan->line2, table->digit2[scan->state]);
+}
+
+// One forward pass over the whole document. Part 1 only counts the digit
+// patterns, a line without any digit adds 0
+static Calibration calibrate(const Matcher *matcher, Span data) {
+  DigitTable table = DigitTable_new(matcher);
+  Scan scan = {0};
+
+  for (usize i = 0; i < data.len; i++) {
+    Scan_byte(&scan, matcher, &table, data.dat[i]);
+  }
+
+  // The last line may not end with a newline
+  Scan_byte(&scan, matcher, &table, '\n');
+
+  return (Calibration){.fst = scan.part1, .snd = scan.part2};
+}
+
+// Line by line, trying every pattern at every offset. Only the benchmark runs
+// it, as a check of the matcher
+static Calibration calibrate_reference(Span data) {
   SpanSplitIterator line_it = Span_split_lines(data);
   u64 part1 = 0;
   u64 part2 = 0;
 
   SpanSplitIteratorNext line = SpanSplitIterator_next(&line_it);
   while (line.valid) {
-    assert(line.dat.len >= 2);
-
     u8 cal[2] = {0};
     u8 cal_2[2] = {0};
 
@@ -71,19 +152,82 @@ void solve(Span data) {
     line = SpanSplitIterator_next(&line_it);
   }
 
+  return (Calibration){.fst = part1, .snd = part2};
+}
+
+static void solve(const Matcher *matcher, Span data) {
+  phase("solve");
+  Calibration calibration = calibrate(matcher, data);
+  phase(NULL);
+
   String out = {0};
-  String_push_u64(&out, part1, 10);
+  String_push_u64(&out, calibration.fst, 10);
   String_push_str(&out, " | ");
-  String_push_u64(&out, part2, 10);
+  String_push_u64(&out, calibration.snd, 10);
   String_println(&out);
 }
 
+// Bytes per ns is GB/s, with two decimals
+static void print_rate(const char *name, usize bytes, u64 ns) {
+  u64 hundredths = bytes * 100 / ns;
+  printf1("%s: ", name);
+  printf3("%u.%u%u GB/s\n", hundredths / 100, hundredths / 10 % 10,
+          hundredths % 10);
+}
+
+// A 1 GB calibration document, with letters of the digit names over-represented
+// so that there are plenty of (overlapping) names
+static void bench(const Matcher *matcher) {
+  static const char alphabet[] = "onetwothreefourfivesixseveneightnine"
+                                 "abcdfjklmpqz123456789\n";
+  u64 state = RAND_SEED;
+  usize len = 1024 * 1024 * 1024;
+
+  u8 *text = (u8 *)calloc(len, sizeof(u8));
+  for (usize i = 0; i < len; i += 8) {
+    u64 r = rand_next(&state);
+    for (usize j = 0; j < 8; j++) {
+      u64 pick = ((r >> (8 * j)) & 0xff) % (sizeof(alphabet) - 1);
+      text[i + j] = (u8)alphabet[pick];
+    }
+  }
+  text[len - 1] = '\n';
+
+  Span document = {.dat = text, .len = len};
+
+  u64 start = time_ns();
+  Calibration calibration = calibrate(matcher, document);
+  u64 time = time_ns() - start;
+
+  // The reference is much slower, only on the first 64 MB (cut after a newline)
+  usize slice = 64 * 1024 * 1024;
+  while (text[slice - 1] != '\n') {
+    slice++;
+  }
+  Span prefix = Span_slice(document, 0, slice);
+
+  u64 reference_start = time_ns();
+  Calibration reference = calibrate_reference(prefix);
+  u64 reference_time = time_ns() - reference_start;
+
+  Calibration check = calibrate(matcher, prefix);
+  assert(check.fst == reference.fst && check.snd == reference.snd);
+
+  printf3("%u bytes: %u | %u\n", len, calibration.fst, calibration.snd);
+  print_rate("reference", slice, reference_time);
+  print_rate("matcher", len, time);
+}
+
 int main(void) {
+  Matcher *matcher = (Matcher *)calloc(1, sizeof(Matcher));
+  Matcher_init(matcher, digit_patterns,
+               sizeof(digit_patterns) / sizeof(digit_patterns[0]));
+
   Span example = Span_from_str("1abc2\n"
                                "pqr3stu8vwx\n"
                                "a1b2c3d4e5f\n"
                                "treb7uchet\n");
-  solve(example);
+  solve(matcher, example);
 
   Span example2 = Span_from_str("two1nine\n"
                                 "eightwothree\n"
@@ -93,10 +237,14 @@ int main(void) {
                                 "zoneight234\n"
                                 "7pqrstsixteen\n");
 
-  solve(example2);
+  solve(matcher, example2);
 
   Span input = Span_from_file("inputs/day01.txt");
-  solve(input);
+  solve(matcher, input);
+
+  if (has_arg("--bench")) {
+    bench(matcher);
+  }
 
   return 0;
 }
@@ -13,6 +13,7 @@ typedef struct {
   GameSets sets;
 } Game;
 
+// Split based parsing, kept to compare against in the bench
 Bag Bag_parse(Span span) {
   Bag bag = {0};
 
@@ -74,6 +75,54 @@ void Game_parse(Game *out, Span line) {
   }
 }
 
+// Formats of a game line, compiled once for all the games
+typedef struct {
+  ScanFormat game;
+  ScanFormat cubes;
+} GameFormats;
+
+GameFormats GameFormats_new(void) {
+  return (GameFormats){
+      .game = ScanFormat_new("Game %u: "),
+      .cubes = ScanFormat_new("%u %w"),
+  };
+}
+
+// Scan a game and its newline (if any) from the cursor
+void Game_scan(Game *out, Scanner *scanner, const GameFormats *formats) {
+  bool ok = scan1(scanner, &formats->game, &out->id);
+  assert_msg(ok, "day02: expected a game id");
+
+  do {
+    Bag bag = {0};
+
+    do {
+      u8 count;
+      Span color;
+      ok = scan2(scanner, &formats->cubes, &count, &color);
+      assert_msg(ok, "day02: expected a count and color");
+
+      switch (color.dat[0]) {
+      case 'r':
+        bag.red = count;
+        break;
+      case 'g':
+        bag.green = count;
+        break;
+      case 'b':
+        bag.blue = count;
+        break;
+      default:
+        panic("Unexpected");
+      }
+    } while (Scanner_more(scanner, ", "));
+
+    GameSets_push(&out->sets, bag);
+  } while (Scanner_more(scanner, "; "));
+
+  Scanner_more(scanner, "\n");
+}
+
 bool Game_possible(const Game *game, Bag bag) {
   for (usize i = 0; i < game->sets.len; i++) {
     Bag set = game->sets.dat[i];
@@ -107,9 +156,43 @@ Bag Game_minimum(const Game *game) {
   return bag;
 }
 
-void solve(Bag bag, Span input) {
-  u64 part1 = 0;
-  u64 part2 = 0;
+typedef T2(u64, u64) Parts;
+
+Parts Game_parts(const Game *game, Bag bag) {
+  Parts parts = {0};
+
+  if (Game_possible(game, bag)) {
+    parts.fst = game->id;
+  }
+
+  Bag minimum = Game_minimum(game);
+  parts.snd = (u64)minimum.red * (u64)minimum.green * (u64)minimum.blue;
+
+  return parts;
+}
+
+Parts run(Bag bag, Span input) {
+  Parts parts = {0};
+  Scanner scanner = Scanner_new(input);
+  GameFormats formats = GameFormats_new();
+
+  Game game = {0};
+
+  while (!Scanner_done(&scanner)) {
+    Game_scan(&game, &scanner, &formats);
+
+    Parts game_parts = Game_parts(&game, bag);
+    parts.fst += game_parts.fst;
+    parts.snd += game_parts.snd;
+
+    memset(&game, 0, sizeof(Game));
+  }
+
+  return parts;
+}
+
+Parts run_split(Bag bag, Span input) {
+  Parts parts = {0};
   SpanSplitIterator line_it = Span_split_lines(input);
 
   Game game = {0};
@@ -118,26 +201,89 @@ void solve(Bag bag, Span input) {
   while (line.valid) {
     Game_parse(&game, line.dat);
 
-    if (Game_possible(&game, bag)) {
-      part1 += game.id;
-    }
-
-    Bag minimum = Game_minimum(&game);
-    u64 power = (u64)minimum.red * (u64)minimum.green * (u64)minimum.blue;
-    part2 += power;
+    Parts game_parts = Game_parts(&game, bag);
+    parts.fst += game_parts.fst;
+    parts.snd += game_parts.snd;
 
     memset(&game, 0, sizeof(Game));
 
     line = SpanSplitIterator_next(&line_it);
   }
 
+  return parts;
+}
+
+void solve(Bag bag, Span input) {
+  phase("solve");
+  Parts parts = run(bag, input);
+  phase(NULL);
+
   String out = {0};
-  String_push_u64(&out, part1, 10);
+  String_push_u64(&out, parts.fst, 10);
   String_push_str(&out, " ");
-  String_push_u64(&out, part2, 10);
+  String_push_u64(&out, parts.snd, 10);
   String_println(&out);
 }
 
+// Parse throughput of the scanner against the split based parsing, on a
+// million random games
+void bench(Bag bag) {
+  static const char *const colors[] = {"red", "green", "blue"};
+  usize games = 1000000;
+  u64 state = RAND_SEED;
+
+  String *text = (String *)calloc(1, sizeof(String));
+  u8 *buf = (u8 *)calloc(games * 200, sizeof(u8));
+  usize len = 0;
+
+  for (usize g = 1; g <= games; g++) {
+    String_clear(text);
+    String_push_str(text, "Game ");
+    String_push_u64(text, g, 10);
+    String_push_str(text, ": ");
+
+    u64 r = rand_next(&state);
+    usize sets = 1 + r % 6;
+    for (usize s = 0; s < sets; s++) {
+      if (s > 0) {
+        String_push_str(text, "; ");
+      }
+
+      u64 c = rand_next(&state);
+      usize cubes = 1 + c % 3;
+      for (usize i = 0; i < cubes; i++) {
+        if (i > 0) {
+          String_push_str(text, ", ");
+        }
+        String_push_u64(text, 1 + (c >> (8 + 8 * i)) % 20, 10);
+        String_push_str(text, " ");
+        String_push_str(text, colors[(s + i) % 3]);
+      }
+    }
+    String_push(text, '\n');
+
+    memcpy(&buf[len], text->dat, text->len);
+    len += text->len;
+  }
+
+  Span input = {.dat = buf, .len = len};
+
+  u64 start = time_ns();
+  Parts split = run_split(bag, input);
+  u64 split_time = time_ns() - start;
+
+  start = time_ns();
+  Parts scanned = run(bag, input);
+  u64 scan_time = time_ns() - start;
+
+  assert(split.fst == scanned.fst && split.snd == scanned.snd);
+
+  printf2("%u bytes: %u", len, scanned.fst);
+  printf1(" %u\n", scanned.snd);
+  printf2("split: %u MB/s | scanner: %u MB/s\n", len * 1000 / split_time,
+          len * 1000 / scan_time);
+}
+
 int main(void) {
   Bag bag = {
       .red = 12,
@@ -158,5 +304,9 @@ int main(void) {
   Span input = Span_from_file("inputs/day02.txt");
   solve(bag, input);
 
+  if (has_arg("--bench")) {
+    bench(bag);
+  }
+
   return 0;
 }
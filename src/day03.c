@@ -1,113 +1,229 @@
 #include "baz.h"
 
+// Streaming engine over a sliding window of three rows. Each row is
+// classified 32 bytes at a time into digit/symbol/gear bit masks, numbers are
+// extracted once per row from the digit mask and checked against the symbol
+// masks of the rows around them, dilated by one cell with shifts. Gears
+// accumulate their adjacent numbers and are settled once the row below them
+// is done. Memory is O(row width).
+
+typedef u8 u8x32 __attribute__((vector_size(32), aligned(1)));
+typedef char i8x32 __attribute__((vector_size(32)));
+
+#define WINDOW 3
+
+static inline u32 movemask(i8x32 x) {
+  return (u32)__builtin_ia32_pmovmskb256(x);
+}
+
 typedef struct {
-  u8 x;
-  u8 y;
-} Pos;
-
-static Hash Pos_hash(const Pos *pos) {
-  FxHasher hasher = {0};
-  FxHasher_add(&hasher, pos->x);
-  FxHasher_add(&hasher, pos->y);
-  return hasher;
+  usize width;
+  usize words;
+  // Ring of WINDOW rows, each words long
+  u64 *digit;
+  u64 *symbol;
+  u64 *gear;
+  // Cells next to a symbol, for the current row
+  u64 *near;
+  // Ring of WINDOW rows, each width long
+  u8 *gear_count;
+  u64 *gear_ratio;
+} Window;
+
+static Window Window_new(usize width) {
+  usize words = (width + 63) / 64;
+  Window window = {
+      .width = width,
+      .words = words,
+      .digit = (u64 *)calloc(WINDOW * words, sizeof(u64)),
+      .symbol = (u64 *)calloc(WINDOW * words, sizeof(u64)),
+      .gear = (u64 *)calloc(WINDOW * words, sizeof(u64)),
+      .near = (u64 *)calloc(words, sizeof(u64)),
+      .gear_count = (u8 *)calloc(WINDOW * width, sizeof(u8)),
+      .gear_ratio = (u64 *)calloc(WINDOW * width, sizeof(u64)),
+  };
+
+  for (usize i = 0; i < WINDOW * width; i++) {
+    window.gear_ratio[i] = 1;
+  }
+
+  return window;
 }
 
-static bool Pos_eq(const Pos *a, const Pos *b) {
-  return a->x == b->x && a->y == b->y;
+static inline usize Window_slot(isize row) {
+  return (usize)((row % WINDOW + WINDOW) % WINDOW);
 }
 
-define_hash_map(Parts, Pos, u32, 2048, Pos_hash, Pos_eq);
+// Classify row (or clear its slot when it is past the end)
+static void Window_classify(Window *window, const u8 *row, usize slot) {
+  u64 *digit = &window->digit[slot * window->words];
+  u64 *symbol = &window->symbol[slot * window->words];
+  u64 *gear = &window->gear[slot * window->words];
 
-static bool is_symbol(u8 c) { return !is_digit(c, 10) && c != '.'; }
+  for (usize w = 0; w < window->words; w++) {
+    digit[w] = 0;
+    symbol[w] = 0;
+    gear[w] = 0;
+  }
 
-static usize index(usize line_len, Pos pos) {
-  return (usize)pos.x + (line_len + 1) * (usize)pos.y;
+  if (row == NULL) {
+    return;
+  }
+
+  for (usize o = 0; o < window->width; o += 32) {
+    // Pad the end of the row with '.'
+    u8 tail[32];
+    const u8 *dat = &row[o];
+    if (window->width - o < 32) {
+      for (usize i = 0; i < 32; i++) {
+        tail[i] = o + i < window->width ? row[o + i] : '.';
+      }
+      dat = tail;
+    }
+
+    u8x32 v = *(const u8x32 *)dat;
+    i8x32 is_digit = (i8x32)((u8x32)(v - '0') < 10);
+    i8x32 is_dot = (i8x32)(v == '.');
+    i8x32 is_gear = (i8x32)(v == '*');
+
+    u32 d = movemask(is_digit);
+    u32 s = ~(d | movemask(is_dot));
+
+    usize shift = o % 64;
+    digit[o / 64] |= (u64)d << shift;
+    symbol[o / 64] |= (u64)s << shift;
+    gear[o / 64] |= (u64)movemask(is_gear) << shift;
+  }
 }
 
-typedef struct {
-  Pos pos;
-  u32 part;
-} Part;
-
-static Part read_part(Span input, usize line_len, Pos from) {
-  u8 x = from.x;
-
-  // Keep going left while it's a digit
-  while (x > 0 &&
-         is_digit(input.dat[index(line_len, (Pos){.x = x - 1, .y = from.y})],
-                  10)) {
-    x--;
+// First index >= from with bit equal to value, or len
+static usize next_bit(const u64 *mask, usize len, usize from, bool value) {
+  while (from < len) {
+    u64 word = value ? mask[from / 64] : ~mask[from / 64];
+    word &= ~(u64)0 << (from % 64);
+    if (word != 0) {
+      usize i = (from & ~(usize)63) + (usize)__builtin_ctzl(word);
+      return i < len ? i : len;
+    }
+    from = (from & ~(usize)63) + 64;
   }
+  return len;
+}
 
-  Pos pos = {.x = x, .y = from.y};
-  usize ix = index(line_len, pos);
-  SpanParseU64 res = Span_parse_u64(Span_slice(input, ix, input.len), 10);
-  assert(res.valid);
+// Dilate the symbols of the rows around row by one cell in every direction:
+// OR the three rows, then each word with itself shifted by one bit both ways,
+// carrying the bits across word boundaries
+static void Window_near(Window *window, isize row) {
+  const u64 *above = &window->symbol[Window_slot(row - 1) * window->words];
+  const u64 *on = &window->symbol[Window_slot(row) * window->words];
+  const u64 *below = &window->symbol[Window_slot(row + 1) * window->words];
+
+  u64 prev = 0;
+  u64 cur = above[0] | on[0] | below[0];
+  for (usize w = 0; w < window->words; w++) {
+    u64 next = w + 1 < window->words ? above[w + 1] | on[w + 1] | below[w + 1]
+                                     : 0;
+    window->near[w] = cur | (cur << 1) | (cur >> 1) | (prev >> 63) |
+                      (next << 63);
+    prev = cur;
+    cur = next;
+  }
+}
 
-  return (Part){.pos = pos, .part = (u32)res.dat.fst};
+typedef struct {
+  u64 part1;
+  u64 part2;
+} Totals;
+
+// Numbers of row, with row - 1 and row + 1 classified already
+static void Window_numbers(Window *window, const u8 *row_dat, isize row,
+                           Totals *totals) {
+  usize width = window->width;
+  const u64 *digit = &window->digit[Window_slot(row) * window->words];
+  Window_near(window, row);
+
+  usize start = next_bit(digit, width, 0, true);
+  while (start < width) {
+    usize end = next_bit(digit, width, start, false);
+    usize from = start > 0 ? start - 1 : 0;
+    usize to = end < width ? end + 1 : width;
+
+    usize len = end - start;
+    u64 value = parse_u64(&row_dat[start], &len, 10);
+
+    // A part has a digit next to a symbol
+    if (next_bit(window->near, end, start, true) < end) {
+      totals->part1 += value;
+    }
+
+    // Gears need their own column, they are looked up around the number
+    for (isize r = row - 1; r <= row + 1; r++) {
+      usize slot = Window_slot(r);
+      const u64 *gear = &window->gear[slot * window->words];
+
+      for (usize c = next_bit(gear, to, from, true); c < to;
+           c = next_bit(gear, to, c + 1, true)) {
+        u8 *count = &window->gear_count[slot * width + c];
+        if (*count < UINT8_MAX) {
+          (*count)++;
+        }
+        window->gear_ratio[slot * width + c] *= value;
+      }
+    }
+
+    start = next_bit(digit, width, end, true);
+  }
 }
 
-typedef Option(Part) OptionPart;
+// Settle the gears of row, once all their adjacent numbers have been seen
+static void Window_gears(Window *window, isize row, Totals *totals) {
+  usize width = window->width;
+  usize slot = Window_slot(row);
+  const u64 *gear = &window->gear[slot * window->words];
 
-static void solve(Span input) {
-  Parts parts = {0};
-  usize part1 = 0;
-  usize part2 = 0;
+  for (usize c = next_bit(gear, width, 0, true); c < width;
+       c = next_bit(gear, width, c + 1, true)) {
+    if (window->gear_count[slot * width + c] == 2) {
+      totals->part2 += window->gear_ratio[slot * width + c];
+    }
+    window->gear_count[slot * width + c] = 0;
+    window->gear_ratio[slot * width + c] = 1;
+  }
+}
 
+static void solve(Span input) {
+  phase("solve");
   SpanSplitOn line = Span_split_on('\n', input);
   assert(line.valid);
-  usize line_len = line.dat.fst.len;
-  usize num_lines = input.len / (line_len + 1);
-
-  for (u8 y = 0; y < (u8)num_lines; y++) {
-    for (u8 x = 0; x < (u8)line_len; x++) {
-      u8 symbol = input.dat[index(line_len, (Pos){.x = x, .y = y})];
-      if (!is_symbol(symbol)) {
-        continue;
-      }
+  usize width = line.dat.fst.len;
+  isize rows = (isize)(input.len / (width + 1));
 
-      OptionPart gear_part = {0};
-      for (isize i = -1; i <= 1; i++) {
-        if ((x == 0 && i == -1) || ((x == line_len - 1) && i == 1)) {
-          continue;
-        }
+  Window window = Window_new(width);
+  Totals totals = {0};
 
-        for (isize j = -1; j <= 1; j++) {
-          if ((y == 0 && j == -1) || ((y == num_lines - 1) && j == 1) ||
-              (i == 0 && j == 0)) {
-            continue;
-          }
-
-          Pos pos = {.x = (u8)((isize)x + i), .y = (u8)((isize)y + j)};
-          if (is_digit(input.dat[index(line_len, pos)], 10)) {
-            Part part = read_part(input, line_len, pos);
-
-            bool overwriting = Parts_insert(&parts, part.pos, part.part);
-
-            if (!overwriting) {
-              part1 += part.part;
-            }
-
-            if (!overwriting && symbol == '*') {
-              if (!gear_part.valid) {
-                gear_part.valid = true;
-                gear_part.dat = part;
-              } else if (!Pos_eq(&gear_part.dat.pos, &pos)) {
-                u32 gear_ratio = gear_part.dat.part * part.part;
-                part2 += gear_ratio;
-              }
-            }
-          }
-        }
-      }
+  for (isize row = -1; row < rows; row++) {
+    const u8 *next = row + 1 < rows ? &input.dat[(usize)(row + 1) * (width + 1)]
+                                    : NULL;
+    Window_classify(&window, next, Window_slot(row + 1));
+
+    if (row < 0) {
+      // Nothing above the first row
+      Window_classify(&window, NULL, Window_slot(row));
+      continue;
     }
+
+    Window_numbers(&window, &input.dat[(usize)row * (width + 1)], row,
+                   &totals);
+    Window_gears(&window, row - 1, &totals);
   }
+  Window_gears(&window, rows - 1, &totals);
+  phase(NULL);
 
   String out = {0};
   String_push_str(&out, "part 1: ");
-  String_push_u64(&out, part1, 10);
+  String_push_u64(&out, totals.part1, 10);
   String_push_str(&out, " | part 2: ");
-  String_push_u64(&out, part2, 10);
+  String_push_u64(&out, totals.part2, 10);
   String_println(&out);
 }
 
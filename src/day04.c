@@ -2,28 +2,94 @@
 
 define_bit_set(Card, u64, 2);
 
-static Card Card_parse(Span x) {
+typedef char i8x16 __attribute__((vector_size(16)));
+typedef u8 u8x16 __attribute__((vector_size(16), aligned(1)));
+typedef i16 i16x8 __attribute__((vector_size(16)));
+
+// Numbers are fixed width fields of 3 bytes (" 42" or "  7"). The SIMD path
+// reads 16 bytes (5 fields) at a time, a shuffle pairs up the tens and ones
+// digits and pmaddubsw computes tens * 10 + ones for each pair.
+#define FIELD 3
+#define FIELDS_PER_LOAD 5
+
+static inline u64 field_value(const u8 *field) {
+  u64 tens = field[1] == ' ' ? 0 : from_digit(field[1], 10);
+  return tens * 10 + from_digit(field[2], 10);
+}
+
+// Parse the fields, reading at most up to end (which can be past fields)
+static Card Card_parse(Span fields, const u8 *end) {
+  assert(fields.len % FIELD == 0);
+  usize count = fields.len / FIELD;
   Card card = {0};
-  SpanSplitIterator word_it = Span_split_words(x);
 
-  SpanSplitIteratorNext word = SpanSplitIterator_next(&word_it);
-  while (word.valid) {
-    if (word.dat.len == 0) {
-      word = SpanSplitIterator_next(&word_it);
-      continue;
+  const i8x16 pairs = {1,  2,  4,  5,  7,  8,  10, 11,
+                       13, 14, -1, -1, -1, -1, -1, -1};
+  const i8x16 weights = {10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 0, 0, 0, 0, 0, 0};
+
+  usize i = 0;
+  for (; i + FIELDS_PER_LOAD <= count &&
+         &fields.dat[i * FIELD] + sizeof(u8x16) <= end;
+       i += FIELDS_PER_LOAD) {
+    u8x16 v = *(const u8x16 *)&fields.dat[i * FIELD];
+    // Spaces (below '0') become 0
+    u8x16 digits = (v - '0') & (u8x16)(v >= '0');
+    i16x8 values =
+        __builtin_ia32_pmaddubsw128(__builtin_ia32_pshufb128((i8x16)digits,
+                                                             pairs),
+                                    weights);
+
+    for (usize l = 0; l < FIELDS_PER_LOAD; l++) {
+      Card_insert(&card, (usize)values[l]);
     }
+  }
 
-    Card_insert(&card, UNWRAP(Span_parse_u64(word.dat, 10)).fst);
-    word = SpanSplitIterator_next(&word_it);
+  for (; i < count; i++) {
+    Card_insert(&card, field_value(&fields.dat[i * FIELD]));
   }
 
   return card;
 }
 
+// Card i only ever adds copies to the next (matches) cards, so a ring buffer
+// longer than the most matches a card can have is enough. A card can't match
+// more than its winning numbers, so the ring starts sized from the first card
+// and grows if a later card has more winning numbers.
+typedef struct {
+  u64 *dat;
+  usize capacity;
+} Ring;
+
+static Ring Ring_new(usize min_capacity) {
+  usize capacity = 1;
+  while (capacity <= min_capacity) {
+    capacity <<= 1;
+  }
+  Ring ring = {.dat = calloc(capacity, sizeof(u64)), .capacity = capacity};
+  assert(ring.dat);
+  return ring;
+}
+
+static inline u64 *Ring_at(Ring *ring, usize ix) {
+  return &ring->dat[ix & (ring->capacity - 1)];
+}
+
+// Keep the pending counts for cards ix onwards at their new positions
+static void Ring_grow(Ring *ring, usize ix, usize min_capacity) {
+  Ring grown = Ring_new(min_capacity);
+  for (usize i = ix; i < ix + ring->capacity; i++) {
+    *Ring_at(&grown, i) = *Ring_at(ring, i);
+  }
+  free(ring->dat);
+  *ring = grown;
+}
+
 static void solve(Span input) {
   u64 part1 = 0;
   u64 part2 = 0;
-  u64 card_copies[256] = {0};
+  Ring ring = {0};
+  const u8 *end = input.dat + input.len;
+  phase("solve");
 
   SpanSplitIterator line_it = Span_split_lines(input);
 
@@ -34,24 +100,34 @@ static void solve(Span input) {
     SpanSplitOn both = Span_split_on('|', both_span);
     assert(both.valid);
 
-    Card winning = Card_parse(both.dat.fst);
-    Card numbers = Card_parse(both.dat.snd);
+    // Drop the space before '|'
+    Span winning_fields = Span_slice(both.dat.fst, 0, both.dat.fst.len - 1);
+    Card winning = Card_parse(winning_fields, end);
+    usize max_count = winning_fields.len / FIELD;
+    if (!ring.dat) {
+      ring = Ring_new(max_count);
+    } else if (max_count >= ring.capacity) {
+      Ring_grow(&ring, ix, max_count);
+    }
+    Card numbers = Card_parse(both.dat.snd, end);
 
     Card match = Card_intersection(winning, numbers);
     usize count = Card_count(match);
+    assert(count < ring.capacity);
     part1 += ((u64)1 << count) >> 1;
 
-    u64 num_cards = card_copies[ix] + 1;
+    u64 num_cards = *Ring_at(&ring, ix) + 1;
+    *Ring_at(&ring, ix) = 0;
     part2 += num_cards;
-    ;
 
     for (usize i = ix + 1; i <= ix + count; i++) {
-      card_copies[i] += num_cards;
+      *Ring_at(&ring, i) += num_cards;
     }
 
     line = SpanSplitIterator_next(&line_it);
     ix++;
   }
+  phase(NULL);
 
   printf2("%u | %u\n", part1, part2);
 }
@@ -66,6 +142,14 @@ int main(void) {
                     "Card 6: 31 18 13 56 72 | 74 77 10 23 35 67 36 11\n");
   solve(example);
 
+  // The second card has more winning numbers than the first, growing the ring
+  Span growing = Span_from_str("Card 1:  1 |  1\n"
+                               "Card 2:  1  2  3 |  1  2  3\n"
+                               "Card 3:  1 |  2\n"
+                               "Card 4:  1 |  2\n"
+                               "Card 5:  1 |  2\n");
+  solve(growing);
+
   Span input = Span_from_file("inputs/day04.txt");
   solve(input);
 
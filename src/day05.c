@@ -182,6 +182,7 @@ static void solve(Span input) {
   Map maps[7] = {0};
 
   // Parsing
+  phase("parse");
   {
     SpanSplitOn split = Span_split_on('\n', input);
     assert(split.valid);
@@ -209,6 +210,7 @@ static void solve(Span input) {
   }
 
   // Part 1
+  phase("part1");
   u64 part1 = UINT32_MAX;
   {
     for (usize i = 0; i < seeds.len; i++) {
@@ -223,6 +225,7 @@ static void solve(Span input) {
   }
 
   // Part 2
+  phase("part2");
   u64 part2 = UINT32_MAX;
   {
     Ranges a = {0};
@@ -252,6 +255,7 @@ static void solve(Span input) {
       }
     }
   }
+  phase(NULL);
 
   printf2("%u | %u\n", part1, part2);
 }
@@ -1,8 +1,9 @@
 #include "baz.h"
 
+// The best distance for a time is time^2 / 4, so distances need 128 bits
 typedef struct {
   u64 time;
-  u64 distance;
+  u128 distance;
 } Race;
 
 define_array(Races, Race, 4);
@@ -21,25 +22,25 @@ static u64 ways(Race race) {
   // ==> ways == 2 * (mid-time - min-charge-time)
   // Note: watch out for off by one for even/odd times
 
-  // binary search for the first charge time that beats the distance
+  // binary search for the first charge time that beats the distance, mid-time
+  // does whenever any charge time does
   u64 mid = race.time >> 1;
 
   u64 min_charge_time = 0;
-  u64 dc = mid;
+  u64 max = mid;
 
-  do {
-    dc >>= 1;
-
-    u64 charge_time = min_charge_time + dc;
+  while (min_charge_time < max) {
+    u64 charge_time = min_charge_time + (max - min_charge_time) / 2;
     u64 run_time = race.time - charge_time;
 
-    if (run_time * charge_time > race.distance) {
+    if ((u128)run_time * charge_time > race.distance) {
       /* left */
+      max = charge_time;
     } else {
       /* right */
-      min_charge_time += dc + 1;
+      min_charge_time = charge_time + 1;
     }
-  } while (dc > 0);
+  }
 
   if ((race.time & 1) == 0) {
     return 2 * (mid - min_charge_time) + 1;
@@ -48,18 +49,97 @@ static u64 ways(Race race) {
   }
 }
 
+// Closed form: charge-time * (time - charge-time) > distance between the roots
+// (time +/- sqrt(time^2 - 4 * distance)) / 2
+static u64 ways_exact(Race race) {
+  u128 time = race.time;
+  u128 time2 = time * time;
+
+  // The best is floor(time^2 / 4), this also keeps 4 * distance from
+  // overflowing below
+  if (race.distance >= time2 / 4) {
+    return 0;
+  }
+
+  u64 root = isqrt(time2 - 4 * race.distance);
+
+  // The exact root (time - sqrt) / 2 is at most half below this, so the first
+  // charge time that beats the distance is this or the next one
+  u64 min_charge_time = (race.time - root) / 2;
+  if ((u128)min_charge_time * (race.time - min_charge_time) <= race.distance) {
+    min_charge_time++;
+  }
+
+  return race.time - 2 * min_charge_time + 1;
+}
+
+static void ways_batch(const Race *races, u64 *ways, usize len) {
+  for (usize i = 0; i < len; i++) {
+    ways[i] = ways_exact(races[i]);
+  }
+}
+
 static void solve(const Races *races) {
-  u64 res = 1;
+  u64 ways[4];
+  phase("solve");
+  ways_batch(races->dat, ways, races->len);
+  phase(NULL);
 
+  u64 res = 1;
   for (usize i = 0; i < races->len; i++) {
-    u64 w = ways(races->dat[i]);
-    res *= w;
+    res *= ways[i];
   }
 
   putu64(res);
   putchar('\n');
 }
 
+// Random winnable races of all sizes, the binary search needs at least one way
+// to win
+static Race Race_random(u64 *state) {
+  u64 time = rand_next(state) >> (rand_next(state) % 63);
+  time = time < 2 ? 2 : time;
+
+  u128 best = (u128)time * time / 4;
+  u128 distance = ((u128)rand_next(state) << 64 | rand_next(state)) % best;
+
+  return (Race){.time = time, .distance = distance};
+}
+
+static void bench(void) {
+  u64 state = RAND_SEED;
+  usize len = 4 * 1000 * 1000;
+
+  Race *races = (Race *)calloc(len, sizeof(Race));
+  u64 *exact = (u64 *)calloc(len, sizeof(u64));
+  for (usize i = 0; i < len; i++) {
+    races[i] = Race_random(&state);
+  }
+
+  // Edges: the longest race only just beaten, and races that can't be won
+  u64 half = UINT64_MAX / 2;
+  races[0] = (Race){
+      .time = UINT64_MAX,
+      .distance = (u128)half * (half + 1) - 1,
+  };
+  assert(ways_exact(races[0]) == 2);
+  assert(ways_exact((Race){.time = 30, .distance = 225}) == 0);
+  assert(ways_exact((Race){.time = 30, .distance = 224}) == 1);
+
+  u64 exact_start = time_ns();
+  ways_batch(races, exact, len);
+  u64 exact_time = time_ns() - exact_start;
+
+  u64 search_start = time_ns();
+  for (usize i = 0; i < len; i++) {
+    assert(ways(races[i]) == exact[i]);
+  }
+  u64 search_time = time_ns() - search_start;
+
+  printf3("%u races: binary search %uus | exact %uus\n", len,
+          search_time / 1000, exact_time / 1000);
+}
+
 int main(void) {
   {
     Races example = {0};
@@ -115,5 +195,9 @@ int main(void) {
     solve(&input);
   }
 
+  if (has_arg("--bench")) {
+    bench();
+  }
+
   return 0;
 }
@@ -62,7 +62,8 @@ static bool U8Array_eq(const U8Array *a, const U8Array *b) {
   return a->len == b->len && memcmp(&a->dat, &b->dat, a->len) == 0;
 }
 
-static Hand Hand_parse(Span x, bool joker) {
+// Reference classifier, sorting the occurences and matching known patterns
+static Hand Hand_parse_reference(Span x, bool joker) {
   assert(x.len == 5);
   Hand hand = {0};
   u8 occurences[15] = {0};
@@ -140,6 +141,90 @@ static Hand Hand_parse(Span x, bool joker) {
   return hand;
 }
 
+// Table-driven classifier. Cards map to ranks through a lookup table, and
+// the occurences of each rank are counted in one nibble of a u64 (SWAR). Each
+// card then reads back its rank's count, and the sum of those (the sum of
+// squared counts) identifies the multiset of counts. Along with the number of
+// jokers, that indexes a small precomputed table of types.
+
+#define JOKER 1
+#define MAX_SIGNATURE 25
+
+static const u8 card_rank[256] = {
+    ['2'] = 2,  ['3'] = 3,  ['4'] = 4,  ['5'] = 5,  ['6'] = 6,
+    ['7'] = 7,  ['8'] = 8,  ['9'] = 9,  ['T'] = 10, ['J'] = 11,
+    ['Q'] = 12, ['K'] = 13, ['A'] = 14,
+};
+
+static const u8 card_rank_joker[256] = {
+    ['2'] = 2,  ['3'] = 3,  ['4'] = 4,  ['5'] = 5,     ['6'] = 6,
+    ['7'] = 7,  ['8'] = 8,  ['9'] = 9,  ['T'] = 10,    ['J'] = JOKER,
+    ['Q'] = 12, ['K'] = 13, ['A'] = 14,
+};
+
+// hand_type[signature][jokers], signature of the non-joker cards
+static Type hand_type[MAX_SIGNATURE + 1][6];
+
+static void hand_type_init(void) {
+  // Every multiset of counts for 0 to 5 non-joker cards, largest first
+  static const u8 partitions[][5] = {
+      {5},          {4, 1},       {3, 2}, {3, 1, 1}, {2, 2, 1},
+      {2, 1, 1, 1}, {1, 1, 1, 1, 1},
+      {4},          {3, 1},       {2, 2}, {2, 1, 1}, {1, 1, 1, 1},
+      {3},          {2, 1},       {1, 1, 1},
+      {2},          {1, 1},
+      {1},
+      {0},
+  };
+  // Types by signature when there is no joker
+  static const u8 signature_types[][2] = {
+      {5, 0}, {7, 1}, {9, 2}, {11, 3}, {13, 4}, {17, 5}, {25, 6},
+  };
+
+  for (usize p = 0; p < sizeof(partitions) / sizeof(partitions[0]); p++) {
+    usize cards = 0;
+    usize signature = 0;
+    for (usize i = 0; i < 5; i++) {
+      cards += partitions[p][i];
+      signature += (usize)partitions[p][i] * partitions[p][i];
+    }
+    usize jokers = 5 - cards;
+
+    // Jokers join the largest count
+    usize promoted = signature - (usize)partitions[p][0] * partitions[p][0] +
+                     (partitions[p][0] + jokers) * (partitions[p][0] + jokers);
+
+    for (usize t = 0; t < 7; t++) {
+      if (signature_types[t][0] == promoted) {
+        hand_type[signature][jokers] = signature_types[t][1];
+      }
+    }
+  }
+}
+
+static Hand Hand_parse(Span x, bool joker) {
+  assert(x.len == 5);
+  const u8 *ranks = joker ? card_rank_joker : card_rank;
+  Hand hand = {0};
+
+  u64 counts = 0;
+  for (usize i = 0; i < 5; i++) {
+    hand.cards[i] = ranks[x.dat[i]];
+    counts += (u64)1 << (4 * hand.cards[i]);
+  }
+
+  u64 jokers = (counts >> (4 * JOKER)) & 0xf;
+  counts &= ~((u64)0xf << (4 * JOKER));
+
+  usize signature = 0;
+  for (usize i = 0; i < 5; i++) {
+    signature += (counts >> (4 * hand.cards[i])) & 0xf;
+  }
+
+  hand.type = hand_type[signature][jokers];
+  return hand;
+}
+
 static Play Play_parse(Span line, bool joker) {
   SpanSplitOn res = Span_split_on(' ', line);
   assert(res.valid);
@@ -152,51 +237,221 @@ static Play Play_parse(Span line, bool joker) {
 
 define_binary_heap(PlaySet, Play, 1024, Play_cmp);
 
-static void solve(Span input) {
-  PlaySet play_set = {0};
-  PlaySet play_set_joker = {0};
+// Heap path: insert every play, then extract them from the lowest hand
+static usize PlaySet_winnings(PlaySet *play_set) {
+  usize winnings = 0;
+  usize rank = 1;
+  PlaySetExtract play = PlaySet_extract(play_set);
+  while (play.valid) {
+    winnings += rank * play.dat.bid;
+
+    rank++;
+    play = PlaySet_extract(play_set);
+  }
+  return winnings;
+}
+
+// A hand's ordering packs in 23 bits: the type then each card in 4 bits. The
+// packed play keeps the key in the upper half and the bid in the lower half
+typedef u64 PackedPlay;
+
+#define KEY_BITS 23
+#define RADIX_BITS 8
+#define RADIX (1 << RADIX_BITS)
+
+static PackedPlay Play_pack(Play play) {
+  u64 key = play.hand.type;
+  for (usize i = 0; i < 5; i++) {
+    key = (key << 4) | play.hand.cards[i];
+  }
+  assert(play.bid <= UINT32_MAX);
+  return (key << 32) | play.bid;
+}
+
+// LSD radix sort on the keys, 8 bits per pass. The number of passes is odd,
+// so the sorted plays end up in tmp
+_Static_assert(((KEY_BITS + RADIX_BITS - 1) / RADIX_BITS) % 2 == 1,
+               "Expected an odd number of radix passes");
+
+static void PackedPlay_sort(PackedPlay *plays, PackedPlay *tmp, usize len) {
+  for (usize shift = 32; shift < 32 + KEY_BITS; shift += RADIX_BITS) {
+    usize counts[RADIX] = {0};
+    for (usize i = 0; i < len; i++) {
+      counts[(plays[i] >> shift) & (RADIX - 1)]++;
+    }
 
+    usize offset = 0;
+    for (usize d = 0; d < RADIX; d++) {
+      usize count = counts[d];
+      counts[d] = offset;
+      offset += count;
+    }
+
+    for (usize i = 0; i < len; i++) {
+      tmp[counts[(plays[i] >> shift) & (RADIX - 1)]++] = plays[i];
+    }
+
+    PackedPlay *t = plays;
+    plays = tmp;
+    tmp = t;
+  }
+}
+
+static usize PackedPlay_winnings(const PackedPlay *sorted, usize len) {
+  usize winnings = 0;
+  for (usize i = 0; i < len; i++) {
+    winnings += (i + 1) * (sorted[i] & UINT32_MAX);
+  }
+  return winnings;
+}
+
+static void solve(Span input) {
+  // Every line is at least 8 bytes long
+  usize max_plays = input.len / 8 + 1;
+  PackedPlay *plays = (PackedPlay *)calloc(max_plays, sizeof(PackedPlay));
+  PackedPlay *plays_joker = (PackedPlay *)calloc(max_plays, sizeof(PackedPlay));
+  PackedPlay *tmp = (PackedPlay *)calloc(max_plays, sizeof(PackedPlay));
+  usize len = 0;
+
+  phase("parse");
   SpanSplitIterator line_it = Span_split_lines(input);
 
   SpanSplitIteratorNext line = SpanSplitIterator_next(&line_it);
   while (line.valid) {
-    Play play = Play_parse(line.dat, false);
-    PlaySet_insert(&play_set, play);
-
-    Play play_joker = Play_parse(line.dat, true);
-    PlaySet_insert(&play_set_joker, play_joker);
+    assert(len < max_plays);
+    plays[len] = Play_pack(Play_parse(line.dat, false));
+    plays_joker[len] = Play_pack(Play_parse(line.dat, true));
+    len++;
 
     line = SpanSplitIterator_next(&line_it);
   }
 
-  usize part1 = 0;
-  {
-    usize rank = 1;
-    PlaySetExtract play = PlaySet_extract(&play_set);
-    while (play.valid) {
-      part1 += rank * play.dat.bid;
+  phase("part1");
+  PackedPlay_sort(plays, tmp, len);
+  usize part1 = PackedPlay_winnings(tmp, len);
 
-      rank++;
-      play = PlaySet_extract(&play_set);
-    }
+  phase("part2");
+  PackedPlay_sort(plays_joker, tmp, len);
+  usize part2 = PackedPlay_winnings(tmp, len);
+  phase(NULL);
+
+  printf2("%u | %u\n", part1, part2);
+}
+
+static Play Play_random(u64 *state) {
+  static const char cards[] = "23456789TJQKA";
+  u8 hand[5];
+  for (usize i = 0; i < 5; i++) {
+    hand[i] = (u8)cards[rand_next(state) % 13];
+  }
+  Play play = {.hand = Hand_parse((Span){.dat = hand, .len = 5}, false)};
+
+  // Derive the bid from the hand, so that equal hands (which can be ranked
+  // either way) don't change the winnings
+  play.bid = (Play_pack(play) >> 32) % 1000 + 1;
+  return play;
+}
+
+// Time the heap against the radix sort on random hands, the heap is capped at
+// PlaySet's capacity so it is timed over many rounds of 1000 hands
+static void bench(void) {
+  u64 state = RAND_SEED;
+  usize rounds = 1000;
+  usize len = 1000;
+
+  Play plays[1000];
+  PackedPlay packed[1000];
+  PackedPlay tmp[1000];
+  for (usize i = 0; i < len; i++) {
+    plays[i] = Play_random(&state);
   }
 
-  usize part2 = 0;
-  {
-    usize rank = 1;
-    PlaySetExtract play = PlaySet_extract(&play_set_joker);
-    while (play.valid) {
-      part2 += rank * play.dat.bid;
+  usize heap_winnings = 0;
+  u64 heap_start = time_ns();
+  for (usize r = 0; r < rounds; r++) {
+    PlaySet play_set = {0};
+    for (usize i = 0; i < len; i++) {
+      PlaySet_insert(&play_set, plays[i]);
+    }
+    heap_winnings = PlaySet_winnings(&play_set);
+  }
+  u64 heap_time = time_ns() - heap_start;
 
-      rank++;
-      play = PlaySet_extract(&play_set_joker);
+  usize radix_winnings = 0;
+  u64 radix_start = time_ns();
+  for (usize r = 0; r < rounds; r++) {
+    for (usize i = 0; i < len; i++) {
+      packed[i] = Play_pack(plays[i]);
     }
+    PackedPlay_sort(packed, tmp, len);
+    radix_winnings = PackedPlay_winnings(tmp, len);
   }
+  u64 radix_time = time_ns() - radix_start;
 
-  printf2("%u | %u\n", part1, part2);
+  assert(heap_winnings == radix_winnings);
+  printf3("%u x %u hands: heap %uus", rounds, len, heap_time / 1000);
+  printf1(" | radix %uus\n", radix_time / 1000);
+
+  usize big_len = 10000000;
+  PackedPlay *big = (PackedPlay *)calloc(big_len, sizeof(PackedPlay));
+  PackedPlay *big_tmp = (PackedPlay *)calloc(big_len, sizeof(PackedPlay));
+  for (usize i = 0; i < big_len; i++) {
+    big[i] = Play_pack(Play_random(&state));
+  }
+
+  u64 big_start = time_ns();
+  PackedPlay_sort(big, big_tmp, big_len);
+  usize big_winnings = PackedPlay_winnings(big_tmp, big_len);
+  u64 big_time = time_ns() - big_start;
+
+  for (usize i = 1; i < big_len; i++) {
+    assert(big_tmp[i - 1] >> 32 <= big_tmp[i] >> 32);
+  }
+  printf3("%u hands: radix %uus (winnings %u)\n", big_len, big_time / 1000,
+          big_winnings);
+
+  // Classifier throughput, over random hands in a text buffer
+  usize text_hands = 1000000;
+  u8 *text = (u8 *)calloc(text_hands * 5, sizeof(u8));
+  static const char cards[] = "23456789TJQKA";
+  for (usize i = 0; i < text_hands * 5; i++) {
+    text[i] = (u8)cards[rand_next(&state) % 13];
+  }
+
+  for (usize joker = 0; joker < 2; joker++) {
+    usize reference_sum = 0;
+    u64 reference_start = time_ns();
+    for (usize i = 0; i < text_hands; i++) {
+      Span x = {.dat = &text[i * 5], .len = 5};
+      reference_sum += Hand_parse_reference(x, joker).type;
+    }
+    u64 reference_time = time_ns() - reference_start;
+
+    usize table_sum = 0;
+    u64 table_start = time_ns();
+    for (usize i = 0; i < text_hands; i++) {
+      Span x = {.dat = &text[i * 5], .len = 5};
+      table_sum += Hand_parse(x, joker).type;
+    }
+    u64 table_time = time_ns() - table_start;
+
+    for (usize i = 0; i < 1000; i++) {
+      Span x = {.dat = &text[i * 5], .len = 5};
+      Hand a = Hand_parse_reference(x, joker);
+      Hand b = Hand_parse(x, joker);
+      assert(a.type == b.type && memcmp(a.cards, b.cards, 5) == 0);
+    }
+    assert(reference_sum == table_sum);
+
+    printf3("classify (joker %u): reference %u hands/s | table %u hands/s\n",
+            joker, text_hands * 1000000000 / reference_time,
+            text_hands * 1000000000 / table_time);
+  }
 }
 
 int main(void) {
+  hand_type_init();
+
   Span example = Span_from_str("32T3K 765\n"
                                "T55J5 684\n"
                                "KK677 28\n"
@@ -207,5 +462,9 @@ int main(void) {
   Span input = Span_from_file("inputs/day07.txt");
   solve(input);
 
+  if (has_arg("--bench")) {
+    bench();
+  }
+
   return 0;
 }
@@ -6,15 +6,59 @@ static u64 gcd(u64 a, u64 b) {
   return gcd(b, a % b);
 }
 
-static u64 lcm(u64 a, u64 b) { return ((a * b) / gcd(a, b)); }
+// Inverse of a modulo m, assuming gcd(a, m) == 1
+static u64 inv_mod(u64 a, u64 m) {
+  i128 old_r = a;
+  i128 r = m;
+  i128 old_s = 1;
+  i128 s = 0;
+
+  while (r != 0) {
+    i128 q = old_r / r;
+    i128 t = r;
+    r = old_r - q * r;
+    old_r = t;
+    t = s;
+    s = old_s - q * s;
+    old_s = t;
+  }
+
+  old_s %= (i128)m;
+  return (u64)(old_s < 0 ? old_s + m : old_s);
+}
+
+// Generalized CRT: solve x = a (mod m) and x = b (mod n), with m and n not
+// necessarily coprime. The solution is modulo lcm(m, n)
+typedef Option(T2(u64, u64)) Crt;
+static Crt crt(u64 a, u64 m, u64 b, u64 n) {
+  u64 g = gcd(m, n);
+  if (a % g != b % g) {
+    return (Crt){.valid = false};
+  }
+
+  u64 m_g = m / g;
+  u64 n_g = n / g;
+  u128 l = (u128)m_g * n;
+  assert_msg(l <= UINT64_MAX, "crt: lcm overflows u64");
+
+  // m * k = b - a (mod n)
+  i128 diff = ((i128)b - (i128)a) / (i128)g % (i128)n_g;
+  u128 d = (u128)(diff < 0 ? diff + n_g : diff);
+  u128 k = d * inv_mod(m_g % n_g, n_g) % n_g;
+  u128 x = ((u128)a + (u128)m * k) % l;
+
+  return (Crt){
+      .valid = true,
+      .dat = {.fst = (u64)x, .snd = (u64)l},
+  };
+}
 
 typedef T2(u16, u16) Node;
 
 define_array(Graph, Node, 1024);
 define_hash_map(NodeName, Span, u16, 1024, Span_hash, Span_eq);
 
-define_array(CountArray, usize, 8);
-define_array(NodeIxArray, u16, 8);
+define_array(NodeIxArray, u16, 1024);
 define_bit_set(NodeIxSet, u64, 16);
 _Static_assert(8 * sizeof(NodeIxSet) == 1024, "Unexpected NodeIxSet size");
 
@@ -28,11 +72,356 @@ static u16 NodeName_intern(NodeName *node_name, u16 *next_node_id, Span node) {
   return id;
 }
 
-static void solve(Span input, bool do_part_1, bool do_part_2) {
-  SpanSplitIterator line_it = Span_split_lines(input);
+static inline u16 Graph_step(const Graph *graph, u16 ix, u8 dir) {
+  switch (dir) {
+  case 'L':
+    return graph->dat[(usize)ix].fst;
+  case 'R':
+    return graph->dat[(usize)ix].snd;
+  default:
+    panic("Unexpected\n");
+  }
+}
+
+// Binary lifting over full passes of the instructions: pass[b][v] is the node
+// reached from v after 2^b passes, and hits[b][v] whether any target node is
+// reached along the way. Building is O(nodes * instructions), then positions
+// and first hits are O(log N) in the number of passes.
+
+#define JUMP_LEVELS 40
+
+typedef struct {
+  const Graph *graph;
+  Span instructions;
+  NodeIxSet targets;
+  u16 *pass[JUMP_LEVELS];
+  bool *hits[JUMP_LEVELS];
+  u32 *first_hit; // steps into a pass until the first target, 0 if none
+} Jumps;
+
+static Jumps Jumps_new(const Graph *graph, Span instructions,
+                       NodeIxSet targets) {
+  usize nodes = graph->len;
+  Jumps jumps = {
+      .graph = graph,
+      .instructions = instructions,
+      .targets = targets,
+      .first_hit = (u32 *)calloc(nodes, sizeof(u32)),
+  };
+  assert(instructions.len <= UINT32_MAX);
+
+  for (usize b = 0; b < JUMP_LEVELS; b++) {
+    jumps.pass[b] = (u16 *)calloc(nodes, sizeof(u16));
+    jumps.hits[b] = (bool *)calloc(nodes, sizeof(bool));
+  }
+
+  for (usize v = 0; v < nodes; v++) {
+    u16 ix = (u16)v;
+    for (usize i = 0; i < instructions.len; i++) {
+      ix = Graph_step(graph, ix, instructions.dat[i]);
+      if (jumps.first_hit[v] == 0 && NodeIxSet_contains(targets, ix)) {
+        jumps.first_hit[v] = (u32)(i + 1);
+      }
+    }
+    jumps.pass[0][v] = ix;
+    jumps.hits[0][v] = jumps.first_hit[v] != 0;
+  }
+
+  for (usize b = 1; b < JUMP_LEVELS; b++) {
+    for (usize v = 0; v < nodes; v++) {
+      u16 half = jumps.pass[b - 1][v];
+      jumps.pass[b][v] = jumps.pass[b - 1][(usize)half];
+      jumps.hits[b][v] = jumps.hits[b - 1][v] || jumps.hits[b - 1][half];
+    }
+  }
+
+  return jumps;
+}
+
+// Node reached from ix (at the start of a pass) after steps steps
+static u16 Jumps_position(const Jumps *jumps, u16 ix, usize steps) {
+  usize passes = steps / jumps->instructions.len;
+  assert(passes >> JUMP_LEVELS == 0);
+
+  for (usize b = 0; b < JUMP_LEVELS; b++) {
+    if ((passes >> b) & 1) {
+      ix = jumps->pass[b][(usize)ix];
+    }
+  }
+
+  for (usize i = 0; i < steps % jumps->instructions.len; i++) {
+    ix = Graph_step(jumps->graph, ix, jumps->instructions.dat[i]);
+  }
+
+  return ix;
+}
+
+// Number of steps from ix, at instruction offset, until the next target
+typedef Option(usize) JumpsHit;
+static JumpsHit Jumps_next_hit(const Jumps *jumps, u16 ix, usize offset) {
+  usize len = jumps->instructions.len;
+  usize steps = 0;
+
+  // Finish the current pass one step at a time
+  if (offset != 0) {
+    for (usize i = offset; i < len; i++) {
+      steps++;
+      ix = Graph_step(jumps->graph, ix, jumps->instructions.dat[i]);
+      if (NodeIxSet_contains(jumps->targets, ix)) {
+        return (JumpsHit){.valid = true, .dat = steps};
+      }
+    }
+  }
 
-  Span instructions = UNWRAP(SpanSplitIterator_next(&line_it));
-  UNWRAP(SpanSplitIterator_next(&line_it)); // Skip newline
+  // Skip the largest number of passes without any hit
+  usize passes = 0;
+  for (usize b = JUMP_LEVELS; b-- > 0;) {
+    if (!jumps->hits[b][(usize)ix]) {
+      ix = jumps->pass[b][(usize)ix];
+      passes += (usize)1 << b;
+    }
+  }
+
+  if (jumps->first_hit[(usize)ix] == 0) {
+    return (JumpsHit){.valid = false};
+  }
+
+  return (JumpsHit){
+      .valid = true,
+      .dat = steps + passes * len + jumps->first_hit[(usize)ix],
+  };
+}
+
+// A ghost's walk over (node, instruction index) states is a tail of length
+// tail followed by a cycle of length period. It is on an end node at the
+// tail_hits times, and at tail + cycle_hits[i] + j * period for any j.
+typedef struct {
+  usize tail;
+  usize period;
+  usize *tail_hits; // ascending
+  usize tail_hits_len;
+  usize *cycle_hits; // ascending, all below period
+  usize cycle_hits_len;
+} GhostCycle;
+
+typedef struct {
+  u16 ix;
+  usize instruction;
+} GhostState;
+
+static inline GhostState GhostState_next(const Graph *graph,
+                                         Span instructions, GhostState s) {
+  return (GhostState){
+      .ix = Graph_step(graph, s.ix, instructions.dat[s.instruction]),
+      .instruction = (s.instruction + 1) % instructions.len,
+  };
+}
+
+static inline bool GhostState_eq(GhostState a, GhostState b) {
+  return a.ix == b.ix && a.instruction == b.instruction;
+}
+
+// Brent's cycle detection, then a walk over tail and cycle to record hits
+static GhostCycle GhostCycle_analyse(const Graph *graph, Span instructions,
+                                     NodeIxSet end, u16 start_ix) {
+  GhostState start = {.ix = start_ix, .instruction = 0};
+
+  usize power = 1;
+  usize period = 1;
+  GhostState tortoise = start;
+  GhostState hare = GhostState_next(graph, instructions, start);
+  while (!GhostState_eq(tortoise, hare)) {
+    if (power == period) {
+      tortoise = hare;
+      power *= 2;
+      period = 0;
+    }
+    hare = GhostState_next(graph, instructions, hare);
+    period++;
+  }
+
+  usize tail = 0;
+  tortoise = start;
+  hare = start;
+  for (usize i = 0; i < period; i++) {
+    hare = GhostState_next(graph, instructions, hare);
+  }
+  while (!GhostState_eq(tortoise, hare)) {
+    tortoise = GhostState_next(graph, instructions, tortoise);
+    hare = GhostState_next(graph, instructions, hare);
+    tail++;
+  }
+
+  GhostCycle cycle = {
+      .tail = tail,
+      .period = period,
+      .tail_hits = (usize *)calloc(tail + 1, sizeof(usize)),
+      .cycle_hits = (usize *)calloc(period, sizeof(usize)),
+  };
+
+  GhostState s = start;
+  for (usize t = 0; t < tail + period; t++) {
+    if (NodeIxSet_contains(end, s.ix)) {
+      if (t < tail) {
+        cycle.tail_hits[cycle.tail_hits_len++] = t;
+      } else {
+        cycle.cycle_hits[cycle.cycle_hits_len++] = t - tail;
+      }
+    }
+    s = GhostState_next(graph, instructions, s);
+  }
+
+  return cycle;
+}
+
+static bool sorted_contains(const usize *dat, usize len, usize x) {
+  usize lo = 0;
+  usize hi = len;
+  while (lo < hi) {
+    usize mid = lo + (hi - lo) / 2;
+    if (dat[mid] < x) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo < len && dat[lo] == x;
+}
+
+static bool GhostCycle_hits(const GhostCycle *cycle, usize t) {
+  if (t < cycle->tail) {
+    return sorted_contains(cycle->tail_hits, cycle->tail_hits_len, t);
+  }
+  return sorted_contains(cycle->cycle_hits, cycle->cycle_hits_len,
+                         (t - cycle->tail) % cycle->period);
+}
+
+// Meeting times modulo the periods combined so far. Each pair of a residue and
+// a hit gives a distinct residue of the new modulus, so there can be as many
+// as the product of the hit counts: the buffer grows
+typedef struct {
+  u64 *dat;
+  usize len;
+  usize capacity;
+} Residues;
+
+static void Residues_push(Residues *residues, u64 x) {
+  if (residues->len == residues->capacity) {
+    usize capacity = residues->capacity == 0 ? 64 : 2 * residues->capacity;
+    u64 *dat = (u64 *)calloc(capacity, sizeof(u64));
+    memcpy(dat, residues->dat, residues->len * sizeof(u64));
+    free(residues->dat);
+    residues->dat = dat;
+    residues->capacity = capacity;
+  }
+
+  residues->dat[residues->len++] = x;
+}
+
+// First time (at least 1) all the ghosts are on an end node at once
+typedef Option(usize) GhostsMeet;
+static GhostsMeet GhostCycle_meet(const GhostCycle *cycles, usize len) {
+  assert(len > 0);
+
+  // Before the longest tail, a meeting has to be one of its tail hits
+  usize longest = 0;
+  for (usize i = 1; i < len; i++) {
+    if (cycles[i].tail > cycles[longest].tail) {
+      longest = i;
+    }
+  }
+
+  const GhostCycle *tailest = &cycles[longest];
+  for (usize h = 0; h < tailest->tail_hits_len; h++) {
+    usize t = tailest->tail_hits[h];
+    bool all = t > 0;
+    for (usize i = 0; all && i < len; i++) {
+      all = GhostCycle_hits(&cycles[i], t);
+    }
+    if (all) {
+      return (GhostsMeet){.valid = true, .dat = t};
+    }
+  }
+
+  // Past every tail the hits are residues, combine them ghost by ghost
+  Residues residues = {0};
+  Residues_push(&residues, 0);
+  u64 modulus = 1;
+
+  for (usize i = 0; i < len; i++) {
+    const GhostCycle *cycle = &cycles[i];
+    Residues next = {0};
+    u64 next_modulus = modulus;
+
+    for (usize r = 0; r < residues.len; r++) {
+      for (usize h = 0; h < cycle->cycle_hits_len; h++) {
+        u64 residue = (cycle->tail + cycle->cycle_hits[h]) % cycle->period;
+        Crt res = crt(residues.dat[r], modulus, residue, cycle->period);
+        if (res.valid) {
+          Residues_push(&next, res.dat.fst);
+          next_modulus = res.dat.snd;
+        }
+      }
+    }
+
+    free(residues.dat);
+    residues = next;
+    modulus = next_modulus;
+  }
+
+  usize from = tailest->tail > 0 ? tailest->tail : 1;
+  GhostsMeet ret = {.valid = false};
+  for (usize r = 0; r < residues.len; r++) {
+    usize t = residues.dat[r];
+    if (t < from) {
+      t += (from - t + modulus - 1) / modulus * modulus;
+    }
+    if (!ret.valid || t < ret.dat) {
+      ret = (GhostsMeet){.valid = true, .dat = t};
+    }
+  }
+
+  return ret;
+}
+
+// A "AAA = (BBB, CCC)" line
+typedef struct {
+  Span name;
+  Span fst;
+  Span snd;
+} NodeLine;
+
+static ScanFormat NodeLine_format(void) {
+  return ScanFormat_new("%w = (%w, %w)");
+}
+
+// Scan a node line and its newline (if any) from the cursor
+static NodeLine NodeLine_scan(Scanner *scanner, const ScanFormat *format) {
+  NodeLine node = {0};
+  bool ok = scan3(scanner, format, &node.name, &node.fst, &node.snd);
+  assert_msg(ok, "day08: expected a node line");
+  Scanner_more(scanner, "\n");
+  return node;
+}
+
+// Fixed offsets parsing, kept to compare against in the bench
+static NodeLine NodeLine_slice(Span line) {
+  return (NodeLine){
+      .name = Span_slice(line, 0, 3),
+      .fst = Span_slice(line, 7, 10),
+      .snd = Span_slice(line, 12, 15),
+  };
+}
+
+// The jump tables check part 2 when asked, they are too slow for every run
+static void solve(Span input, bool do_part_1, bool do_part_2, bool check) {
+  phase("parse");
+  Scanner scanner = Scanner_new(input);
+
+  ScanFormat instructions_format = ScanFormat_new("%w\n\n");
+  Span instructions;
+  bool ok = scan1(&scanner, &instructions_format, &instructions);
+  assert_msg(ok, "day08: expected the instructions");
 
   Graph graph = {0};
   u16 AAA_ix = 0;
@@ -50,15 +439,14 @@ static void solve(Span input, bool do_part_1, bool do_part_2) {
     // Mapping from node id to its index in the graph
     u16 node_id_to_ix[1024] = {0};
 
-    SpanSplitIteratorNext line = SpanSplitIterator_next(&line_it);
-    while (line.valid) {
-      Span name = Span_slice(line.dat, 0, 3);
-      Span fst = Span_slice(line.dat, 7, 10);
-      Span snd = Span_slice(line.dat, 12, 15);
+    ScanFormat node_format = NodeLine_format();
+    while (!Scanner_done(&scanner)) {
+      NodeLine line = NodeLine_scan(&scanner, &node_format);
+      Span name = line.name;
 
       u16 node = NodeName_intern(&node_name, &next_node_id, name);
-      u16 node_fst = NodeName_intern(&node_name, &next_node_id, fst);
-      u16 node_snd = NodeName_intern(&node_name, &next_node_id, snd);
+      u16 node_fst = NodeName_intern(&node_name, &next_node_id, line.fst);
+      u16 node_snd = NodeName_intern(&node_name, &next_node_id, line.snd);
 
       u16 ix = (u16)graph.len;
       Graph_push(&graph, (Node){
@@ -80,8 +468,6 @@ static void solve(Span input, bool do_part_1, bool do_part_2) {
       if (name.dat[2] == 'Z') {
         NodeIxSet_insert(&end_with_Z, ix);
       }
-
-      line = SpanSplitIterator_next(&line_it);
     }
 
     // Fixup graph to use ix instead of IDs now that all IDs are resolved
@@ -93,90 +479,138 @@ static void solve(Span input, bool do_part_1, bool do_part_2) {
 
   usize part1 = 0;
   if (do_part_1) {
-    u16 ix = AAA_ix;
-    bool found = false;
-
-    while (!found) {
-      for (usize i = 0; i < instructions.len; i++) {
-        part1++;
-        u8 dir = instructions.dat[i];
-
-        switch (dir) {
-        case 'L':
-          ix = graph.dat[(usize)ix].fst;
-          break;
-        case 'R':
-          ix = graph.dat[(usize)ix].snd;
-          break;
-        default:
-          panic("Unexpected\n");
-        }
+    phase("part1");
+    NodeIxSet targets = {0};
+    NodeIxSet_insert(&targets, ZZZ_ix);
+    Jumps jumps = Jumps_new(&graph, instructions, targets);
 
-        if (ix == ZZZ_ix) {
-          found = true;
-          break;
-        }
-      }
-    }
+    part1 = UNWRAP(Jumps_next_hit(&jumps, AAA_ix, 0));
   }
 
   usize part2 = 0;
   if (do_part_2) {
-    CountArray first_time_at_end = {0};
-    CountArray period = {0};
-    NodeIxArray end_node_ix = {0};
+    phase("part2");
+    GhostCycle cycles[NodeIxArray_capacity];
+    for (usize i = 0; i < end_with_A.len; i++) {
+      cycles[i] = GhostCycle_analyse(&graph, instructions, end_with_Z,
+                                     end_with_A.dat[i]);
+    }
+
+    part2 = UNWRAP(GhostCycle_meet(cycles, end_with_A.len));
+  }
+  phase(NULL);
 
+  if (do_part_2 && check) {
+    Jumps jumps = Jumps_new(&graph, instructions, end_with_Z);
     for (usize i = 0; i < end_with_A.len; i++) {
-      usize count = 0;
-      u16 ix = end_with_A.dat[i];
-      bool found = false;
-
-      while (!found) {
-        for (usize j = 0; j < instructions.len; j++) {
-          count++;
-          u8 dir = instructions.dat[j];
-
-          switch (dir) {
-          case 'L':
-            ix = graph.dat[(usize)ix].fst;
-            break;
-          case 'R':
-            ix = graph.dat[(usize)ix].snd;
-            break;
-          default:
-            panic("Unexpected\n");
-          }
-
-          if (NodeIxSet_contains(end_with_Z, ix)) {
-            if (first_time_at_end.len == i) {
-              // First time at end
-              CountArray_push(&first_time_at_end, count);
-              NodeIxArray_push(&end_node_ix, ix);
-            } else if (end_node_ix.dat[i] == ix) {
-              // Second time hitting the same node
-              CountArray_push(&period, count - first_time_at_end.dat[i]);
-              found = true;
-              break;
-            }
-          }
-        }
+      u16 ix = Jumps_position(&jumps, end_with_A.dat[i], part2);
+      assert(NodeIxSet_contains(end_with_Z, ix));
+    }
+  }
+
+  printf2("%u | %u\n", part1, part2);
+}
+
+// Name of node i on the ring of a ghost, about half of them end with Z
+static usize ring_name(u8 *text, u8 ghost, usize i) {
+  text[0] = ghost;
+  text[1] = (u8)('A' + i);
+  text[2] = (i * 7 + ghost) % 2 == 0 ? 'Z' : 'B';
+  return 3;
+}
+
+// Ghosts on coprime rings with many end nodes each, so that the meeting
+// residues far outnumber any fixed buffer
+static void bench_many_hits(void) {
+  static const usize rings[] = {17, 19, 23, 25};
+  u8 *text = (u8 *)calloc(4096, sizeof(u8));
+  usize len = 0;
+
+  memcpy(&text[len], "L\n\n", 3);
+  len += 3;
+
+  for (usize g = 0; g < sizeof(rings) / sizeof(rings[0]); g++) {
+    u8 ghost = (u8)('P' + g);
+
+    // The start, then the ring
+    for (usize i = 0; i <= rings[g]; i++) {
+      if (i == 0) {
+        text[len++] = ghost;
+        text[len++] = 'A';
+        text[len++] = 'A';
+      } else {
+        len += ring_name(&text[len], ghost, i - 1);
       }
+
+      usize next = i % rings[g];
+      memcpy(&text[len], " = (", 4);
+      len += 4;
+      len += ring_name(&text[len], ghost, next);
+      memcpy(&text[len], ", ", 2);
+      len += 2;
+      len += ring_name(&text[len], ghost, next);
+      memcpy(&text[len], ")\n", 2);
+      len += 2;
     }
+  }
 
-    part2 = 1;
-    for (usize i = 0; i < first_time_at_end.len; i++) {
-      // It looks like the input was nice and the offset and period are the same
-      // Asserting it
-      assert(first_time_at_end.dat[i] == period.dat[i]);
+  solve((Span){.dat = text, .len = len}, false, true, true);
+}
+
+// Folds the node names so that the parsing can't be optimised out
+static u64 NodeLine_check(NodeLine line) {
+  return (u64)line.name.dat[0] + (u64)line.fst.dat[1] + (u64)line.snd.dat[2];
+}
 
-      part2 = lcm(part2, period.dat[i]);
+// Parse throughput of the scanner against the fixed offsets, on 4M node lines
+static void bench(void) {
+  usize lines = 4 * 1024 * 1024;
+  usize line_len = 17;
+  u64 state = RAND_SEED;
+
+  u8 *buf = (u8 *)calloc(lines * line_len, sizeof(u8));
+  for (usize l = 0; l < lines; l++) {
+    u8 *line = &buf[l * line_len];
+    memcpy(line, "AAA = (BBB, CCC)\n", line_len);
+
+    u64 r = rand_next(&state);
+    usize offsets[] = {0, 1, 2, 7, 8, 9, 12, 13, 14};
+    for (usize i = 0; i < 9; i++) {
+      line[offsets[i]] = (u8)('A' + (r >> (6 * i)) % 26);
     }
   }
 
-  printf2("%u | %u\n", part1, part2);
+  Span input = {.dat = buf, .len = lines * line_len};
+
+  u64 start = time_ns();
+  u64 sliced = 0;
+  SpanSplitIterator line_it = Span_split_lines(input);
+  SpanSplitIteratorNext line = SpanSplitIterator_next(&line_it);
+  while (line.valid) {
+    sliced += NodeLine_check(NodeLine_slice(line.dat));
+    line = SpanSplitIterator_next(&line_it);
+  }
+  u64 slice_time = time_ns() - start;
+
+  start = time_ns();
+  u64 scanned = 0;
+  Scanner scanner = Scanner_new(input);
+  ScanFormat format = NodeLine_format();
+  while (!Scanner_done(&scanner)) {
+    scanned += NodeLine_check(NodeLine_scan(&scanner, &format));
+  }
+  u64 scan_time = time_ns() - start;
+
+  assert(sliced == scanned);
+
+  printf2("%u bytes: %u\n", input.len, scanned);
+  printf2("slices: %u MB/s | scanner: %u MB/s\n",
+          input.len * 1000 / slice_time, input.len * 1000 / scan_time);
 }
 
 int main(void) {
+  bool check = has_arg("--bench");
+
   Span example1 = Span_from_str("RL\n"
                                 "\n"
                                 "AAA = (BBB, CCC)\n"
@@ -186,14 +620,14 @@ int main(void) {
                                 "EEE = (EEE, EEE)\n"
                                 "GGG = (GGG, GGG)\n"
                                 "ZZZ = (ZZZ, ZZZ)\n");
-  solve(example1, true, false);
+  solve(example1, true, false, check);
 
   Span example2 = Span_from_str("LLR\n"
                                 "\n"
                                 "AAA = (BBB, BBB)\n"
                                 "BBB = (AAA, ZZZ)\n"
                                 "ZZZ = (ZZZ, ZZZ)\n");
-  solve(example2, true, false);
+  solve(example2, true, false, check);
 
   Span example3 = Span_from_str("LR\n"
                                 "\n"
@@ -205,10 +639,30 @@ int main(void) {
                                 "22C = (22Z, 22Z)\n"
                                 "22Z = (22B, 22B)\n"
                                 "XXX = (XXX, XXX)\n");
-  solve(example3, false, true);
+  solve(example3, false, true, check);
+
+  // Tails differing from the periods, and several end nodes in a cycle
+  Span example4 = Span_from_str("L\n"
+                                "\n"
+                                "11A = (11B, 11B)\n"
+                                "11B = (11Z, 11Z)\n"
+                                "11Z = (12Z, 12Z)\n"
+                                "12Z = (11C, 11C)\n"
+                                "11C = (11Z, 11Z)\n"
+                                "22A = (22B, 22B)\n"
+                                "22B = (22C, 22C)\n"
+                                "22C = (22D, 22D)\n"
+                                "22D = (22Z, 22Z)\n"
+                                "22Z = (22B, 22B)\n");
+  solve(example4, false, true, check);
 
   Span input = Span_from_file("inputs/day08.txt");
-  solve(input, true, true);
+  solve(input, true, true, check);
+
+  if (has_arg("--bench")) {
+    bench();
+    bench_many_hits();
+  }
 
   return 0;
 }
@@ -1,15 +1,13 @@
 #include "baz.h"
 
-define_array(Nums, i64, 32);
-define_array(Stack, Nums, 32);
+// Longest sequence supported, C(128, 64) still fits in an i128
+#define MAX_LEN 128
 
-static inline void Stack_reset(Stack *stack) {
-  for (usize i = 0; i < stack->len; i++) {
-    stack->dat[i].len = 0;
-  }
+// Longest sequence for the vectorised path, all the coefficients fit in an
+// i32 and sums of up to MAX_LEN_FAST products of i32s can't overflow an i64
+#define MAX_LEN_FAST 31
 
-  stack->len = 0;
-}
+define_array(Nums, i64, MAX_LEN);
 
 static void Nums_parse(Nums *nums, Span line) {
   SpanParseI64 res = Span_parse_i64(line, 10);
@@ -31,58 +29,261 @@ typedef struct {
   i64 after;
 } Predict;
 
-static Predict predict(Stack *stack) {
-  assert(stack->len < 32);
+// A sequence of length n is extrapolated by a polynomial of degree below n
+// (which is what repeated differences compute), so the n-th difference over
+// x[-1..n] is zero and both ends are fixed linear combinations of x[0..n):
+//   after  = sum (-1)^(n - i + 1) C(n, i) x[i]
+//   before = sum (-1)^i C(n, i + 1) x[i]
+typedef struct {
+  bool ready;
+  i128 after[MAX_LEN];
+  i128 before[MAX_LEN];
+} Kernel;
 
-  Nums *in = &stack->dat[stack->len - 1];
-  Nums *out = &stack->dat[stack->len];
-  stack->len++;
+static Kernel kernels[MAX_LEN + 1];
 
-  bool all_zeros = true;
-  i64 first = in->dat[0];
-  i64 last = in->dat[in->len - 1];
+static const Kernel *Kernel_get(usize n) {
+  assert(n > 0 && n <= MAX_LEN);
+  Kernel *kernel = &kernels[n];
+  if (kernel->ready) {
+    return kernel;
+  }
 
-  for (usize i = 0; i < in->len - 1; i++) {
-    i64 diff = in->dat[i + 1] - in->dat[i];
-    if (diff != 0) {
-      all_zeros = false;
+  // Row n of Pascal's triangle
+  i128 binomial[MAX_LEN + 1] = {1};
+  for (usize row = 1; row <= n; row++) {
+    for (usize i = row; i > 0; i--) {
+      binomial[i] += binomial[i - 1];
     }
+  }
 
-    Nums_push(out, diff);
+  for (usize i = 0; i < n; i++) {
+    kernel->after[i] = ((n - i) % 2 == 1) ? binomial[i] : -binomial[i];
+    kernel->before[i] = (i % 2 == 0) ? binomial[i + 1] : -binomial[i + 1];
   }
 
-  if (all_zeros) {
-    return (Predict){.before = first, .after = last};
-  } else {
-    Predict p = predict(stack);
-    return (Predict){
-        .before = first - p.before,
-        .after = last + p.after,
-    };
+  kernel->ready = true;
+  return kernel;
+}
+
+// Exact path for any length: i128 sums, the results have to fit in an i64
+static Predict predict_checked(const Nums *nums) {
+  const Kernel *kernel = Kernel_get(nums->len);
+
+  i128 after = 0;
+  i128 before = 0;
+  for (usize i = 0; i < nums->len; i++) {
+    i128 after_term;
+    i128 before_term;
+    assert_msg(!__builtin_mul_overflow(kernel->after[i], nums->dat[i],
+                                       &after_term) &&
+                   !__builtin_add_overflow(after, after_term, &after),
+               "predict: overflow");
+    assert_msg(!__builtin_mul_overflow(kernel->before[i], nums->dat[i],
+                                       &before_term) &&
+                   !__builtin_add_overflow(before, before_term, &before),
+               "predict: overflow");
   }
+
+  assert_msg(after >= INT64_MIN && after <= INT64_MAX,
+             "predict: result overflows i64");
+  assert_msg(before >= INT64_MIN && before <= INT64_MAX,
+             "predict: result overflows i64");
+
+  return (Predict){.before = (i64)before, .after = (i64)after};
+}
+
+static bool Nums_fast(const Nums *nums) {
+  if (nums->len > MAX_LEN_FAST) {
+    return false;
+  }
+
+  for (usize i = 0; i < nums->len; i++) {
+    if (nums->dat[i] < -(i64)INT32_MAX || nums->dat[i] > INT32_MAX) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// AVX2 lanes, one sequence per lane
+typedef i64 i64x4 __attribute__((vector_size(32)));
+typedef int i32x8 __attribute__((vector_size(32)));
+#define BATCH 4
+
+// Nums_fast sequences of one length waiting to fill a batch, stored
+// transposed: lane l of column i is x[i] of the l-th sequence
+typedef struct {
+  i64x4 columns[MAX_LEN_FAST];
+  usize len;
+} Batch;
+
+static void Batch_push(Batch *batch, const Nums *nums) {
+  for (usize i = 0; i < nums->len; i++) {
+    batch->columns[i][batch->len] = nums->dat[i];
+  }
+  batch->len++;
+}
+
+// Predict the sequences of length n in the batch. Every value and coefficient
+// fits in an i32 and is sign extended in its lane, so pmuldq (which multiplies
+// the low halves of the lanes as signed) gives the exact i64 products. Lanes
+// past batch->len hold stale values and are ignored
+static void predict_batch(const Batch *batch, usize n, Predict *out) {
+  const Kernel *kernel = Kernel_get(n);
+
+  i64x4 after = {0};
+  i64x4 before = {0};
+  for (usize i = 0; i < n; i++) {
+    i32x8 x = (i32x8)batch->columns[i];
+    i64x4 after_coef = {0};
+    i64x4 before_coef = {0};
+    after_coef += (i64)kernel->after[i];
+    before_coef += (i64)kernel->before[i];
+
+    after += (i64x4)__builtin_ia32_pmuldq256(x, (i32x8)after_coef);
+    before += (i64x4)__builtin_ia32_pmuldq256(x, (i32x8)before_coef);
+  }
+
+  for (usize l = 0; l < batch->len; l++) {
+    out[l] = (Predict){.before = before[l], .after = after[l]};
+  }
+}
+
+typedef T2(i64, i64) Parts;
+
+// Sums the predictions of sequences given one at a time. Batching can be
+// turned off, to compare in the benchmark
+typedef struct {
+  bool batched;
+  // Batches are filled by length, so lines don't need to be in any order
+  Batch batches[MAX_LEN_FAST + 1];
+  Parts parts;
+} Predictor;
+
+static void Predictor_add(Predictor *predictor, const Nums *nums) {
+  if (!predictor->batched || !Nums_fast(nums)) {
+    Predict p = predict_checked(nums);
+    predictor->parts.fst += p.after;
+    predictor->parts.snd += p.before;
+    return;
+  }
+
+  Batch *batch = &predictor->batches[nums->len];
+  Batch_push(batch, nums);
+
+  if (batch->len == BATCH) {
+    Predict p[BATCH];
+    predict_batch(batch, nums->len, p);
+    for (usize l = 0; l < BATCH; l++) {
+      predictor->parts.fst += p[l].after;
+      predictor->parts.snd += p[l].before;
+    }
+    batch->len = 0;
+  }
+}
+
+// Add the leftovers of the partial batches
+static Parts Predictor_finish(Predictor *predictor) {
+  for (usize n = 1; n <= MAX_LEN_FAST; n++) {
+    Batch *batch = &predictor->batches[n];
+    Predict p[BATCH];
+    predict_batch(batch, n, p);
+    for (usize l = 0; l < batch->len; l++) {
+      predictor->parts.fst += p[l].after;
+      predictor->parts.snd += p[l].before;
+    }
+    batch->len = 0;
+  }
+
+  return predictor->parts;
 }
 
 static void solve(Span input) {
   SpanSplitIterator line_it = Span_split_lines(input);
+  Predictor predictor = {.batched = true};
+  Nums nums = {0};
 
-  i64 part1 = 0;
-  i64 part2 = 0;
-  Stack stack = {0};
+  phase("solve");
 
   SpanSplitIteratorNext line = SpanSplitIterator_next(&line_it);
   while (line.valid) {
-    Stack_reset(&stack);
-    Nums_parse(&stack.dat[stack.len], line.dat);
-    stack.len++;
-
-    Predict p = predict(&stack);
-    part1 += p.after;
-    part2 += p.before;
+    nums.len = 0;
+    Nums_parse(&nums, line.dat);
+    Predictor_add(&predictor, &nums);
 
     line = SpanSplitIterator_next(&line_it);
   }
 
-  printf2("%u | %u\n", part1, part2);
+  Parts parts = Predictor_finish(&predictor);
+  phase(NULL);
+
+  printf2("%u | %u\n", parts.fst, parts.snd);
+}
+
+// Predict all the sequences, stored one after the other in dat
+static Parts predict_all(const i64 *dat, const u8 *lens, usize count,
+                         bool batched) {
+  static Predictor predictor;
+  predictor = (Predictor){.batched = batched};
+  Nums nums = {0};
+
+  for (usize i = 0; i < count; i++) {
+    nums.len = lens[i];
+    memcpy(nums.dat, dat, lens[i] * sizeof(i64));
+    dat += lens[i];
+    Predictor_add(&predictor, &nums);
+  }
+
+  return Predictor_finish(&predictor);
+}
+
+// A million sequences of lengths in random order, batched against the i128
+// path for every one. They're generated already parsed, parsing would be
+// most of the time otherwise
+static void bench(void) {
+  usize count = 1000 * 1000;
+  u64 state = RAND_SEED;
+
+  i64 *dat = (i64 *)calloc(count * MAX_LEN_FAST, sizeof(i64));
+  u8 *lens = (u8 *)calloc(count, sizeof(u8));
+  usize len = 0;
+
+  for (usize s = 0; s < count; s++) {
+    // Cubics with small coefficients, the puzzle's are about that size
+    lens[s] = (u8)(5 + rand_next(&state) % (MAX_LEN_FAST - 4));
+    i64 c[4];
+    for (usize k = 0; k < 4; k++) {
+      c[k] = (i64)(rand_next(&state) % 41) - 20;
+    }
+
+    for (usize i = 0; i < lens[s]; i++) {
+      i64 x = (i64)i - 8;
+      dat[len++] = ((c[3] * x + c[2]) * x + c[1]) * x + c[0];
+    }
+  }
+
+  // Best of a few runs each
+  Parts scalar = {0};
+  Parts batched = {0};
+  u64 scalar_time = UINT64_MAX;
+  u64 batched_time = UINT64_MAX;
+  for (usize rep = 0; rep < 5; rep++) {
+    u64 start = time_ns();
+    scalar = predict_all(dat, lens, count, false);
+    u64 t = time_ns() - start;
+    scalar_time = t < scalar_time ? t : scalar_time;
+
+    start = time_ns();
+    batched = predict_all(dat, lens, count, true);
+    t = time_ns() - start;
+    batched_time = t < batched_time ? t : batched_time;
+  }
+
+  assert(scalar.fst == batched.fst && scalar.snd == batched.snd);
+  printf3("%u sequences (%i | %i)\n", count, batched.fst, batched.snd);
+  printf2("scalar %uus | batched %uus\n", scalar_time / 1000,
+          batched_time / 1000);
 }
 
 int main(void) {
@@ -94,5 +295,9 @@ int main(void) {
   Span input = Span_from_file("inputs/day09.txt");
   solve(input);
 
+  if (has_arg("--bench")) {
+    bench();
+  }
+
   return 0;
 }
@@ -17,21 +17,6 @@ static inline Pos Pos_from_ix(usize width, usize i) {
 
 define_array(PosArray, Pos, 4);
 
-typedef struct {
-  u64 dat[312]; // To accommodate 141 * 140 bits
-} PosSet;
-
-unused static bool PosSet_contains_pos(const PosSet *s, Pos p, usize width) {
-  usize i = Pos_to_ix(width, p);
-  return ((s->dat[(i >> 6)] >> (i & 0b111111)) & 1) == 1;
-}
-
-static void PosSet_insert_pos(PosSet *s, Pos p, usize width) {
-  usize i = Pos_to_ix(width, p);
-  assert((i >> 6) < 312);
-  s->dat[(i >> 6)] |= ((u64)1 << (i & 0b111111));
-}
-
 static PosArray neighbours(Pos p, const u8 *maze, usize width, usize height) {
   usize i = Pos_to_ix(width, p);
   PosArray ns = {0};
@@ -97,7 +82,11 @@ static PosArray neighbours(Pos p, const u8 *maze, usize width, usize height) {
   return ns;
 }
 
+// Walk the loop once from the start, accumulating twice the enclosed area with
+// the shoelace formula. Pick's theorem (A = i + b / 2 - 1) then gives the
+// number of interior tiles i from the area A and the b tiles of the loop.
 static void solve(Span input) {
+  phase("solve");
   usize width = UNWRAP(Span_split_on('\n', input)).fst.len;
   usize height = input.len / (width + 1);
   Pos start = Pos_from_ix(width, UNWRAP(Span_split_on('S', input)).fst.len);
@@ -116,161 +105,51 @@ static void solve(Span input) {
     PosArray_push(&start_neighbours, (Pos){.x = start.x, .y = start.y + 1});
   }
 
-  PosArray current = {0};
-  PosArray next = {0};
-  PosSet loop = {0};
-  PosSet_insert_pos(&loop, start, width);
-
-  u8 start_mask = 0;
-
+  // Any neighbour connected back to the start is on the loop
+  Pos current = start;
   for (usize i = 0; i < start_neighbours.len; i++) {
     Pos n = start_neighbours.dat[i];
     PosArray ns = neighbours(n, input.dat, width, height);
-    if (ns.len < 2) {
-      continue;
+    if (ns.len == 2 &&
+        (Pos_eq(start, ns.dat[0]) || Pos_eq(start, ns.dat[1]))) {
+      current = n;
+      break;
     }
-    if (Pos_eq(start, ns.dat[0])) {
-      PosSet_insert_pos(&loop, n, width);
-      PosArray_push(&current, n);
-      PosArray_push(&next, ns.dat[1]);
-    } else if (Pos_eq(start, ns.dat[1])) {
-      PosSet_insert_pos(&loop, n, width);
-      PosArray_push(&current, n);
-      PosArray_push(&next, ns.dat[0]);
-    } else {
-      continue;
-    }
-
-    // UP
-    if (n.y < start.y) {
-      start_mask |= 0b0001;
-    }
-    // RIGHT
-    if (n.x > start.x) {
-      start_mask |= 0b0010;
-    }
-    // DOWN
-    if (n.y > start.y) {
-      start_mask |= 0b0100;
-    }
-    // LEFT
-    if (n.x < start.x) {
-      start_mask |= 0b1000;
-    }
-  }
-
-  u8 s;
-
-  switch (start_mask) {
-  case 0b1010:
-    s = '-';
-    break;
-  case 0b0101:
-    s = '|';
-    break;
-  case 0b0110:
-    s = 'F';
-    break;
-  case 0b0011:
-    s = 'L';
-    break;
-  case 0b1100:
-    s = '7';
-    break;
-  case 0b1001:
-    s = 'J';
-    break;
-  default:
-    panic("Unexpected\n");
   }
+  assert(!Pos_eq(current, start));
 
-  assert(current.len == 2);
-  assert(next.len == 2);
-
-  usize part1 = 1;
-  while (!Pos_eq(current.dat[0], current.dat[1])) {
-    part1++;
+  Pos previous = start;
+  usize loop_len = 0;
+  i64 area2 = 0;
 
-    {
-      PosArray ns = neighbours(next.dat[0], input.dat, width, height);
+  while (true) {
+    loop_len++;
+    area2 +=
+        (i64)previous.x * (i64)current.y - (i64)current.x * (i64)previous.y;
 
-      if (Pos_eq(current.dat[0], ns.dat[0])) {
-        current.dat[0] = next.dat[0];
-        next.dat[0] = ns.dat[1];
-      } else if (Pos_eq(current.dat[0], ns.dat[1])) {
-        current.dat[0] = next.dat[0];
-        next.dat[0] = ns.dat[0];
-      } else {
-        panic("Unexpected\n");
-      }
-      PosSet_insert_pos(&loop, current.dat[0], width);
+    if (Pos_eq(current, start)) {
+      break;
     }
 
-    {
-      PosArray ns = neighbours(next.dat[1], input.dat, width, height);
-      if (Pos_eq(current.dat[1], ns.dat[0])) {
-        current.dat[1] = next.dat[1];
-        next.dat[1] = ns.dat[1];
-      } else if (Pos_eq(current.dat[1], ns.dat[1])) {
-        current.dat[1] = next.dat[1];
-        next.dat[1] = ns.dat[0];
-      } else {
-        panic("Unexpected\n");
-      }
-      PosSet_insert_pos(&loop, current.dat[1], width);
+    PosArray ns = neighbours(current, input.dat, width, height);
+    Pos next;
+    if (Pos_eq(previous, ns.dat[0])) {
+      next = ns.dat[1];
+    } else if (Pos_eq(previous, ns.dat[1])) {
+      next = ns.dat[0];
+    } else {
+      panic("Unexpected\n");
     }
-  }
-
-  usize part2 = 0;
-
-  for (u16 y = 0; y < height; y++) {
-    bool inside = false;
-    u8 section_start = 0;
-
-    for (u16 x = 0; x < width; x++) {
-      Pos p = {.x = x, .y = y};
-      if (PosSet_contains_pos(&loop, p, width)) {
-        usize i = Pos_to_ix(width, p);
 
-        u8 c = input.dat[i];
-
-        if (c == 'S') {
-          c = s;
-        }
-
-        switch (c) {
-        case '-':
-          break;
-        case '|':
-          inside = !inside;
-          break;
-        // Start section
-        case 'F':
-          section_start = 'F';
-          break;
-        case 'L':
-          section_start = 'L';
-          break;
-        // End section
-        case '7':
-          if (section_start == 'L') {
-            inside = !inside;
-          }
-          break;
-        case 'J':
-          if (section_start == 'F') {
-            inside = !inside;
-          }
-          break;
-        default:
-          panic("Unexpected\n");
-        }
-      } else if (inside) {
-        part2++;
-      }
-    }
+    previous = current;
+    current = next;
   }
 
+  usize area = (usize)(area2 < 0 ? -area2 : area2) / 2;
+  usize part1 = loop_len / 2;
+  usize part2 = area + 1 - loop_len / 2;
+  phase(NULL);
+
   printf2("%u | %u\n", part1, part2);
 }
 
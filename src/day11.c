@@ -1,48 +1,68 @@
 #include "baz.h"
 
+// Pairwise distances along one axis, as a function of the expansion factor f:
+// raw + (f - 1) * empty, where raw sums the distances between the original
+// coordinates and empty the number of empty lines in between
 typedef struct {
-  u64 x;
-  u64 y;
-} Pos;
+  u64 raw;
+  u64 empty;
+} Distances;
+
+// Galaxy coordinates are line indices, so a histogram per line is already a
+// counting sort of the coordinates. Summing |a - b| over sorted values is then
+// one pass with a running count and running sums.
+static Distances Distances_from_histogram(const u64 *counts, usize len) {
+  Distances d = {0};
+
+  u64 seen = 0;
+  u64 raw_sum = 0;
+  u64 empty_sum = 0;
+  u64 empty = 0;
+
+  for (usize i = 0; i < len; i++) {
+    u64 n = counts[i];
+    if (n == 0) {
+      empty++;
+      continue;
+    }
 
-static inline Pos Pos_add(Pos a, Pos b) {
-  return (Pos){.x = a.x + b.x, .y = a.y + b.y};
-}
+    d.raw += n * (seen * i - raw_sum);
+    d.empty += n * (seen * empty - empty_sum);
 
-static inline Pos Pos_mul(Pos a, usize n) {
-  return (Pos){.x = n * a.x, .y = n * a.y};
-}
+    seen += n;
+    raw_sum += n * i;
+    empty_sum += n * empty;
+  }
 
-static usize manhattan_distance(Pos a, Pos b) {
-  return ABS_DIFF(usize, (usize)a.x, (usize)b.x) +
-         ABS_DIFF(usize, (usize)a.y, (usize)b.y);
+  return d;
 }
 
-define_array(Galaxies, Pos, 512);
-define_bit_set(GalaxySet, u64, 3);
+static u64 Distances_at(Distances d, u64 factor) {
+  u64 extra;
+  u64 total;
+  assert(!__builtin_mul_overflow(d.empty, factor - 1, &extra));
+  assert(!__builtin_add_overflow(d.raw, extra, &total));
+  return total;
+}
 
 static void solve(Span input) {
-  SpanSplitIterator line_it = Span_split_lines(input);
+  phase("parse");
+  usize width = UNWRAP(Span_split_on('\n', input)).fst.len;
+  usize height = input.len / (width + 1);
 
-  Galaxies galaxies = {0};
-  Galaxies expanse = {0};
+  u64 *columns = (u64 *)calloc(width, sizeof(u64));
+  u64 *rows = (u64 *)calloc(height, sizeof(u64));
 
-  GalaxySet columns = {0};
-  GalaxySet rows = {0};
-
-  u64 y = 0;
+  SpanSplitIterator line_it = Span_split_lines(input);
+  usize y = 0;
   SpanSplitIteratorNext line = SpanSplitIterator_next(&line_it);
   while (line.valid) {
-    for (usize i = 0; i < line.dat.len; i++) {
-      if (line.dat.dat[i] == '#') {
-        u64 x = (u64)i;
-        Galaxies_push(&galaxies, (Pos){
-                                     .x = x,
-                                     .y = y,
-                                 });
-
-        GalaxySet_insert(&columns, x);
-        GalaxySet_insert(&rows, y);
+    assert(line.dat.len == width && y < height);
+
+    for (usize x = 0; x < width; x++) {
+      if (line.dat.dat[x] == '#') {
+        columns[x]++;
+        rows[y]++;
       }
     }
 
@@ -50,43 +70,14 @@ static void solve(Span input) {
     line = SpanSplitIterator_next(&line_it);
   }
 
-  // Universe expanse
-  for (usize i = 0; i < galaxies.len; i++) {
-    Pos p = galaxies.dat[i];
-
-    GalaxySet x_mask = {0};
-    GalaxySet_set_many(&x_mask, p.x);
-
-    GalaxySet y_mask = {0};
-    GalaxySet_set_many(&y_mask, p.y);
+  phase("solve");
+  Distances dx = Distances_from_histogram(columns, width);
+  Distances dy = Distances_from_histogram(rows, height);
+  Distances d = {.raw = dx.raw + dy.raw, .empty = dx.empty + dy.empty};
 
-    usize x_expansion =
-        p.x - GalaxySet_count(GalaxySet_intersection(x_mask, columns));
-    usize y_expansion =
-        p.y - GalaxySet_count(GalaxySet_intersection(y_mask, rows));
-
-    Galaxies_push(&expanse, (Pos){.x = x_expansion, .y = y_expansion});
-  }
-
-  usize part1 = 0;
-  usize part2 = 0;
-  for (usize i = 0; i < galaxies.len - 1; i++) {
-    for (usize j = i + 1; j < galaxies.len; j++) {
-      {
-        Pos p_i = Pos_add(galaxies.dat[i], expanse.dat[i]);
-        Pos p_j = Pos_add(galaxies.dat[j], expanse.dat[j]);
-
-        part1 += manhattan_distance(p_i, p_j);
-      }
-
-      {
-        Pos p_i = Pos_add(galaxies.dat[i], Pos_mul(expanse.dat[i], 999999));
-        Pos p_j = Pos_add(galaxies.dat[j], Pos_mul(expanse.dat[j], 999999));
-
-        part2 += manhattan_distance(p_i, p_j);
-      }
-    }
-  }
+  usize part1 = Distances_at(d, 2);
+  usize part2 = Distances_at(d, 1000000);
+  phase(NULL);
 
   printf2("%u | %u\n", part1, part2);
 }
@@ -123,47 +123,661 @@ static usize Springs_arrangements(Springs springs) {
   return n;
 }
 
+// Bottom-up DP over (position, group), row j at i counts the ways to place the
+// first j groups within locations[0..i) leaving no '#' uncovered. Only two
+// rows are kept alive, so scratch must hold 3 * (locations.len + 1) u64s.
+//
+// Note: counts wrap around past u64 (which only happens for large unfolds)
+static u64 Springs_arrangements_dp(Span locations, const u8 *groups,
+                                   usize groups_len, u64 *scratch) {
+  usize n = locations.len;
+  u64 *run = scratch;             // run[i]: non-'.' run ending at i - 1
+  u64 *prev = &scratch[n + 1];    // row j - 1
+  u64 *cur = &scratch[2 * n + 2]; // row j
+
+  run[0] = 0;
+  prev[0] = 1;
+  for (usize i = 1; i <= n; i++) {
+    u8 c = locations.dat[i - 1];
+    run[i] = c == '.' ? 0 : run[i - 1] + 1;
+    prev[i] = c == '#' ? 0 : prev[i - 1];
+  }
+
+  for (usize j = 0; j < groups_len; j++) {
+    usize group = groups[j];
+
+    cur[0] = 0;
+    for (usize i = 1; i <= n; i++) {
+      u64 ways = locations.dat[i - 1] == '#' ? 0 : cur[i - 1];
+
+      // Place group over locations[i - group..i)
+      if (run[i] >= group) {
+        if (i == group) {
+          ways += prev[0];
+        } else if (i > group && locations.dat[i - group - 1] != '#') {
+          ways += prev[i - group - 1];
+        }
+      }
+
+      cur[i] = ways;
+    }
+
+    u64 *t = prev;
+    prev = cur;
+    cur = t;
+  }
+
+  return prev[n];
+}
+
+// Springs repeated k times (joined with '?'), in buffers allocated once
+typedef struct {
+  usize max_len;
+  usize max_groups;
+  u8 *locations;
+  usize locations_len;
+  u8 *groups;
+  usize groups_len;
+  u64 *scratch; // [3 * (max_len + 1)]
+} Unfolded;
+
+static Unfolded Unfolded_new(usize max_len, usize max_groups) {
+  return (Unfolded){
+      .max_len = max_len,
+      .max_groups = max_groups,
+      .locations = (u8 *)calloc(max_len, sizeof(u8)),
+      .groups = (u8 *)calloc(max_groups, sizeof(u8)),
+      .scratch = (u64 *)calloc(3 * (max_len + 1), sizeof(u64)),
+  };
+}
+
+static void Unfolded_set(Unfolded *unfolded, Springs springs, usize k) {
+  assert(k > 0);
+  assert((springs.locations.len + 1) * k - 1 <= unfolded->max_len);
+  assert(springs.groups.len * k <= unfolded->max_groups);
+
+  unfolded->locations_len = 0;
+  unfolded->groups_len = 0;
+  for (usize i = 0; i < k; i++) {
+    if (i > 0) {
+      unfolded->locations[unfolded->locations_len++] = '?';
+    }
+    memcpy(&unfolded->locations[unfolded->locations_len],
+           springs.locations.dat, springs.locations.len);
+    unfolded->locations_len += springs.locations.len;
+    memcpy(&unfolded->groups[unfolded->groups_len], springs.groups.dat,
+           springs.groups.len);
+    unfolded->groups_len += springs.groups.len;
+  }
+}
+
+static u64 Unfolded_arrangements(const Unfolded *unfolded) {
+  return Springs_arrangements_dp(
+      (Span){.dat = unfolded->locations, .len = unfolded->locations_len},
+      unfolded->groups, unfolded->groups_len, unfolded->scratch);
+}
+
+// The recursive search uses u8 offsets and a fixed size Groups
+static bool Unfolded_fits_rec(const Unfolded *unfolded) {
+  return unfolded->locations_len < UINT8_MAX &&
+         unfolded->groups_len <= Groups_capacity;
+}
+
+static Springs Unfolded_springs(const Unfolded *unfolded) {
+  Springs springs = {
+      .locations = {.dat = unfolded->locations,
+                    .len = unfolded->locations_len},
+  };
+  for (usize i = 0; i < unfolded->groups_len; i++) {
+    Groups_push(&springs.groups, unfolded->groups[i]);
+  }
+  return springs;
+}
+
+// Transfer-matrix engine for large unfold factors. The unfolded springs are
+// (P?)^(k-1) P and walking one "P?" block maps a boundary state to the next
+// one. A boundary state is the offset d of completed groups against the groups
+// of the copies walked so far, along with the length r of the current run of
+// '#'. Raising the block transfer to the power k-1 costs O(s^3 log k) for s
+// boundary states, without materialising the unfolded springs.
+//
+// Lines where d can drift out of a small window don't have a small closed set
+// of boundary states, so this returns nothing and callers fall back to
+// Springs_arrangements_drift. That is the case when a copy can hold more or
+// fewer groups than its own, the reachable offsets then grow with k and no
+// window is enough: about half of the puzzle lines. Counts are modulo 2^64,
+// like Springs_arrangements_dp.
+
+#define TM_WINDOW 8
+#define TM_MAX_STATES 48
+#define TM_MIN_UNFOLD 32
+
+typedef struct {
+  i64 d;
+  u8 r;
+} TmState;
+
+static bool TmState_eq(const TmState *a, const TmState *b) {
+  return a->d == b->d && a->r == b->r;
+}
+
+define_array(TmStates, TmState, TM_MAX_STATES);
+
+typedef struct {
+  u64 dat[TM_MAX_STATES][TM_MAX_STATES];
+} Matrix;
+
+// c = a * b for the first len rows/columns, c must not alias a or b
+static void Matrix_mul(Matrix *c, const Matrix *a, const Matrix *b, usize len) {
+  for (usize i = 0; i < len; i++) {
+    for (usize j = 0; j < len; j++) {
+      u64 x = 0;
+      for (usize l = 0; l < len; l++) {
+        x += a->dat[i][l] * b->dat[l][j];
+      }
+      c->dat[i][j] = x;
+    }
+  }
+}
+
+// Size of group j, where j counts groups across copies (and can be negative)
+static inline usize Springs_group(Springs springs, i64 j) {
+  i64 n = (i64)springs.groups.len;
+  return springs.groups.dat[((j % n) + n) % n];
+}
+
+// Walk chunk from the boundary state from, out[dd * (max_r + 1) + r] is the
+// number of ways to end with dd more completed groups and a run of length r.
+// Both out and tmp must hold (chunk.len + 1) * (max_r + 1) u64s
+static void Springs_walk(Springs springs, Span chunk, TmState from,
+                         usize max_r, u64 *out, u64 *tmp) {
+  usize stride = max_r + 1;
+  usize size = (chunk.len + 1) * stride;
+
+  u64 *cur = (chunk.len % 2 == 0) ? out : tmp;
+  u64 *next = (chunk.len % 2 == 0) ? tmp : out;
+  memset(cur, 0, size * sizeof(u64));
+  cur[from.r] = 1;
+
+  for (usize i = 0; i < chunk.len; i++) {
+    u8 c = chunk.dat[i];
+    memset(next, 0, size * sizeof(u64));
+
+    for (usize dd = 0; dd <= i; dd++) {
+      usize group = Springs_group(springs, from.d + (i64)dd);
+      for (usize r = 0; r <= max_r; r++) {
+        u64 ways = cur[dd * stride + r];
+        if (ways == 0) {
+          continue;
+        }
+
+        if (c != '#') {
+          if (r == 0) {
+            next[dd * stride] += ways;
+          } else if (r == group) {
+            next[(dd + 1) * stride] += ways;
+          }
+        }
+
+        if (c != '.' && r < group) {
+          next[dd * stride + r + 1] += ways;
+        }
+      }
+    }
+
+    u64 *t = cur;
+    cur = next;
+    next = t;
+  }
+}
+
+typedef Option(u64) TmArrangements;
+static TmArrangements Springs_arrangements_tm(Springs springs, usize k) {
+  assert(k > 0);
+  TmArrangements ret = {.valid = false};
+
+  usize len = springs.locations.len;
+  i64 groups_len = (i64)springs.groups.len;
+  usize max_r = 0;
+  for (usize i = 0; i < springs.groups.len; i++) {
+    max_r = springs.groups.dat[i] > max_r ? springs.groups.dat[i] : max_r;
+  }
+  usize stride = max_r + 1;
+
+  u8 block_dat[len + 1]; // VLA
+  memcpy(block_dat, springs.locations.dat, len);
+  block_dat[len] = '?';
+  Span block = {.dat = block_dat, .len = len + 1};
+
+  u64 out[(len + 2) * stride]; // VLA
+  u64 tmp[(len + 2) * stride]; // VLA
+
+  // Discover the boundary states reachable from the start, and the block
+  // transfer between them
+  TmStates states = {0};
+  TmStates_push(&states, (TmState){.d = 0, .r = 0});
+  Matrix transfer = {0};
+  Matrix power;
+  Matrix scratch;
+
+  for (usize i = 0; i < states.len; i++) {
+    TmState from = states.dat[i];
+    Springs_walk(springs, block, from, max_r, out, tmp);
+
+    for (usize dd = 0; dd <= block.len; dd++) {
+      for (usize r = 0; r <= max_r; r++) {
+        u64 ways = out[dd * stride + r];
+        if (ways == 0) {
+          continue;
+        }
+
+        TmState to = {.d = from.d + (i64)dd - groups_len, .r = (u8)r};
+        if (to.d > TM_WINDOW || to.d < -TM_WINDOW) {
+          return ret;
+        }
+
+        TmStatesLookup lookup =
+            TmStates_linear_lookup(&states, &to, TmState_eq);
+        if (!lookup.valid) {
+          if (states.len == TmStates_capacity) {
+            return ret;
+          }
+          TmStates_push(&states, to);
+          lookup.dat = states.len - 1;
+        }
+        transfer.dat[i][lookup.dat] += ways;
+      }
+    }
+  }
+
+  // v = start * transfer^(k-1)
+  u64 v[TM_MAX_STATES] = {1};
+  u64 w[TM_MAX_STATES];
+  memcpy(&power, &transfer, sizeof(Matrix));
+  for (usize e = k - 1; e > 0; e >>= 1) {
+    if (e & 1) {
+      for (usize j = 0; j < states.len; j++) {
+        w[j] = 0;
+        for (usize i = 0; i < states.len; i++) {
+          w[j] += v[i] * power.dat[i][j];
+        }
+      }
+      memcpy(v, w, sizeof(v));
+    }
+    if (e > 1) {
+      Matrix_mul(&scratch, &power, &power, states.len);
+      memcpy(&power, &scratch, sizeof(Matrix));
+    }
+  }
+
+  // Walk the last copy (without the trailing '?') and accept if every group
+  // was placed
+  u64 arrangements = 0;
+  for (usize i = 0; i < states.len; i++) {
+    if (v[i] == 0) {
+      continue;
+    }
+
+    TmState from = states.dat[i];
+    Springs_walk(springs, springs.locations, from, max_r, out, tmp);
+
+    for (usize dd = 0; dd <= len; dd++) {
+      i64 placed = from.d + (i64)dd;
+      if (placed == groups_len) {
+        arrangements += v[i] * out[dd * stride];
+      } else if (placed == groups_len - 1) {
+        arrangements +=
+            v[i] * out[dd * stride + Springs_group(springs, groups_len - 1)];
+      }
+    }
+  }
+
+  ret.valid = true;
+  ret.dat = arrangements;
+  return ret;
+}
+
+// Transfer for the lines whose offset drifts, with the offset tracked exactly
+// in the algebra. A boundary state is the group g next in line (the offset d
+// modulo the groups of a copy) and the run r, the counts of each state are a
+// polynomial in x where x^q counts q whole copies of groups completed ahead of
+// (or behind) the copies walked, so that d = q * groups + g. Walking a block
+// maps a state to another and multiplies by some x^dq: the block transfer is a
+// matrix of monomials, and applying it shifts and adds whole polynomials. The
+// answer is read off the constant terms after the last copy.
+//
+// The polynomials are as wide as the offsets reachable after m copies, which
+// grows with m, so they are stepped one block at a time rather than raised to
+// a power: O(k^2) instead of O(log k), still without materialising the
+// unfolded springs. Powers that can't get back to 0 by the last copy are
+// dropped along the way.
+
+// From one boundary state, a block ends in state to times x^dq
+typedef struct {
+  usize to; // g * (max_r + 1) + r
+  i64 dq;
+  u64 ways;
+} DriftEdge;
+
+typedef struct {
+  usize len;
+  DriftEdge *dat;
+} DriftEdges;
+
+static DriftEdges DriftEdges_walk(Springs springs, Span chunk, usize state,
+                                  usize max_r, u64 *out, u64 *tmp) {
+  usize stride = max_r + 1;
+  usize groups_len = springs.groups.len;
+  usize g = state / stride;
+
+  DriftEdges edges = {
+      .dat = (DriftEdge *)calloc((chunk.len + 1) * stride, sizeof(DriftEdge)),
+  };
+  Springs_walk(springs, chunk, (TmState){.d = (i64)g, .r = (u8)(state % stride)},
+               max_r, out, tmp);
+
+  for (usize dd = 0; dd <= chunk.len; dd++) {
+    for (usize r = 0; r <= max_r; r++) {
+      u64 ways = out[dd * stride + r];
+      if (ways != 0) {
+        edges.dat[edges.len++] = (DriftEdge){
+            .to = ((g + dd) % groups_len) * stride + r,
+            .dq = (i64)((g + dd) / groups_len) - 1,
+            .ways = ways,
+        };
+      }
+    }
+  }
+
+  return edges;
+}
+
+static u64 Springs_arrangements_drift(Springs springs, usize k) {
+  assert(k > 0);
+
+  usize len = springs.locations.len;
+  usize groups_len = springs.groups.len;
+  usize max_r = 0;
+  for (usize i = 0; i < groups_len; i++) {
+    max_r = springs.groups.dat[i] > max_r ? springs.groups.dat[i] : max_r;
+  }
+  usize stride = max_r + 1;
+  usize last_group = springs.groups.dat[groups_len - 1];
+
+  u8 block_dat[len + 1]; // VLA
+  memcpy(block_dat, springs.locations.dat, len);
+  block_dat[len] = '?';
+  Span block = {.dat = block_dat, .len = len + 1};
+
+  u64 out[(len + 2) * stride]; // VLA
+  u64 tmp[(len + 2) * stride]; // VLA
+
+  // Walk the block and the last copy from every state reachable from the
+  // start, states are numbered in the order they are found
+  usize states = groups_len * stride;
+  usize *number = (usize *)calloc(states, sizeof(usize)); // 1 based
+  usize *found = (usize *)calloc(states, sizeof(usize));
+  DriftEdges *edges = (DriftEdges *)calloc(states, sizeof(DriftEdges));
+  DriftEdges *last = (DriftEdges *)calloc(states, sizeof(DriftEdges));
+  usize found_len = 0;
+
+  // Range of the powers a block (or the last copy) multiplies by
+  i64 dq_lo = INT64_MAX;
+  i64 dq_hi = INT64_MIN;
+  i64 last_lo = INT64_MAX;
+  i64 last_hi = INT64_MIN;
+
+  found[found_len++] = 0;
+  number[0] = 1;
+  for (usize i = 0; i < found_len; i++) {
+    edges[i] = DriftEdges_walk(springs, block, found[i], max_r, out, tmp);
+    last[i] =
+        DriftEdges_walk(springs, springs.locations, found[i], max_r, out, tmp);
+
+    for (usize e = 0; e < edges[i].len; e++) {
+      DriftEdge *edge = &edges[i].dat[e];
+      dq_lo = edge->dq < dq_lo ? edge->dq : dq_lo;
+      dq_hi = edge->dq > dq_hi ? edge->dq : dq_hi;
+
+      if (number[edge->to] == 0) {
+        found[found_len++] = edge->to;
+        number[edge->to] = found_len;
+      }
+      edge->to = number[edge->to] - 1;
+    }
+
+    for (usize e = 0; e < last[i].len; e++) {
+      last_lo = last[i].dat[e].dq < last_lo ? last[i].dat[e].dq : last_lo;
+      last_hi = last[i].dat[e].dq > last_hi ? last[i].dat[e].dq : last_hi;
+    }
+  }
+  if (dq_lo > dq_hi || last_lo > last_hi) {
+    return 0;
+  }
+
+  // The last copy accepts powers q with q + dq in {-1, 0}
+  i64 end_lo = -1 - last_hi;
+  i64 end_hi = -last_lo;
+
+  // cur[state * span + q - first_q], only [lo, hi] is live
+  i64 blocks = (i64)k - 1;
+  i64 first_q = blocks * dq_lo < 0 ? blocks * dq_lo : 0;
+  i64 last_q = blocks * dq_hi > 0 ? blocks * dq_hi : 0;
+  usize span = (usize)(last_q - first_q + 1);
+  u64 *cur = (u64 *)calloc(found_len * span, sizeof(u64));
+  u64 *next = (u64 *)calloc(found_len * span, sizeof(u64));
+  cur[(usize)(0 - first_q)] = 1;
+  i64 lo = 0;
+  i64 hi = 0;
+
+  for (i64 m = 1; m <= blocks; m++) {
+    i64 left = blocks - m;
+    i64 next_lo = lo + dq_lo;
+    i64 next_hi = hi + dq_hi;
+    next_lo = next_lo > end_lo - left * dq_hi ? next_lo : end_lo - left * dq_hi;
+    next_hi = next_hi < end_hi - left * dq_lo ? next_hi : end_hi - left * dq_lo;
+    if (next_lo > next_hi) {
+      return 0;
+    }
+
+    for (usize i = 0; i < found_len; i++) {
+      memset(&next[i * span + (usize)(next_lo - first_q)], 0,
+             (usize)(next_hi - next_lo + 1) * sizeof(u64));
+    }
+
+    for (usize i = 0; i < found_len; i++) {
+      for (usize e = 0; e < edges[i].len; e++) {
+        DriftEdge edge = edges[i].dat[e];
+        i64 q_lo = lo > next_lo - edge.dq ? lo : next_lo - edge.dq;
+        i64 q_hi = hi < next_hi - edge.dq ? hi : next_hi - edge.dq;
+        if (q_lo > q_hi) {
+          continue;
+        }
+
+        const u64 *from = &cur[i * span + (usize)(q_lo - first_q)];
+        u64 *to = &next[edge.to * span + (usize)(q_lo + edge.dq - first_q)];
+        for (usize j = 0; j <= (usize)(q_hi - q_lo); j++) {
+          to[j] += from[j] * edge.ways;
+        }
+      }
+    }
+
+    u64 *t = cur;
+    cur = next;
+    next = t;
+    lo = next_lo;
+    hi = next_hi;
+  }
+
+  // The last copy (without the trailing '?') has placed every group when it
+  // ends on the first group of the next copy at power 0, or in the last group
+  // with its run complete at power -1
+  u64 arrangements = 0;
+  for (usize i = 0; i < found_len; i++) {
+    for (usize e = 0; e < last[i].len; e++) {
+      DriftEdge edge = last[i].dat[e];
+      usize g = edge.to / stride;
+      usize r = edge.to % stride;
+
+      i64 q;
+      if (g == 0 && r == 0) {
+        q = -edge.dq;
+      } else if (g == groups_len - 1 && r == last_group) {
+        q = -1 - edge.dq;
+      } else {
+        continue;
+      }
+
+      if (q >= lo && q <= hi) {
+        arrangements += cur[i * span + (usize)(q - first_q)] * edge.ways;
+      }
+    }
+  }
+
+  return arrangements;
+}
+
+// Springs unfolded k times: the DP over the materialised springs for small k,
+// and the transfer matrix (or the drift transfer when the line needs it) for
+// larger ones
+static u64 Springs_arrangements_unfolded(Unfolded *unfolded, Springs springs,
+                                         usize k) {
+  if (k >= TM_MIN_UNFOLD) {
+    TmArrangements tm = Springs_arrangements_tm(springs, k);
+    return tm.valid ? tm.dat : Springs_arrangements_drift(springs, k);
+  }
+
+  Unfolded_set(unfolded, springs, k);
+  return Unfolded_arrangements(unfolded);
+}
+
 static void solve(Span input) {
   SpanSplitIterator line_it = Span_split_lines(input);
 
   usize part1 = 0;
   usize part2 = 0;
 
-  String locations = {0};
-  Groups groups = {0};
+  Unfolded unfolded = Unfolded_new((input.len + 1) * 5, input.len * 5);
+  phase("solve");
 
   SpanSplitIteratorNext line = SpanSplitIterator_next(&line_it);
   while (line.valid) {
     Springs springs = Springs_parse(line.dat);
 
-    String_clear(&locations);
-    groups.len = 0;
-    for (usize i = 0; i < 5; i++) {
-      if (i > 0) {
-        String_push(&locations, '?');
-      }
-      String_push_span(&locations, springs.locations);
-      for (usize j = 0; j < springs.groups.len; j++) {
-        Groups_push(&groups, springs.groups.dat[j]);
-      }
-    }
-
     part1 += Springs_arrangements(springs);
-    part2 += Springs_arrangements((Springs){
-        .locations =
-            {
-                .dat = locations.dat,
-                .len = locations.len,
-            },
-        .groups = groups,
-    });
+    part2 += Springs_arrangements_unfolded(&unfolded, springs, 5);
 
     line = SpanSplitIterator_next(&line_it);
   }
+  phase(NULL);
 
   printf2("%u | %u\n", part1, part2);
 }
 
+// Time the recursive search against the iterative DP for a few unfold
+// factors, the recursive search is skipped when lines don't fit its offsets
+static void bench(Span input) {
+  static const usize factors[] = {5, 20, 100};
+
+  for (usize f = 0; f < sizeof(factors) / sizeof(factors[0]); f++) {
+    usize k = factors[f];
+    Unfolded unfolded = Unfolded_new((input.len + 1) * k, input.len * k);
+
+    bool rec_fits = true;
+    u64 rec_sum = 0;
+    u64 rec_start = time_ns();
+    SpanSplitIterator line_it = Span_split_lines(input);
+    SpanSplitIteratorNext line = SpanSplitIterator_next(&line_it);
+    while (line.valid && rec_fits) {
+      Unfolded_set(&unfolded, Springs_parse(line.dat), k);
+      rec_fits = Unfolded_fits_rec(&unfolded);
+      if (rec_fits) {
+        rec_sum += Springs_arrangements(Unfolded_springs(&unfolded));
+      }
+      line = SpanSplitIterator_next(&line_it);
+    }
+    u64 rec_time = time_ns() - rec_start;
+
+    u64 dp_sum = 0;
+    u64 dp_start = time_ns();
+    line_it = Span_split_lines(input);
+    line = SpanSplitIterator_next(&line_it);
+    while (line.valid) {
+      Unfolded_set(&unfolded, Springs_parse(line.dat), k);
+      dp_sum += Unfolded_arrangements(&unfolded);
+      line = SpanSplitIterator_next(&line_it);
+    }
+    u64 dp_time = time_ns() - dp_start;
+
+    if (rec_fits) {
+      assert(rec_sum == dp_sum);
+      printf3("unfold %u: rec %uus | dp %uus\n", k, rec_time / 1000,
+              dp_time / 1000);
+    } else {
+      printf2("unfold %u: rec n/a | dp %uus\n", k, dp_time / 1000);
+    }
+  }
+}
+
+// Time the transfer matrix on lines where it applies and the drift transfer
+// on the others, checking both against the DP on the smaller unfold factors
+// (the DP has to materialise the unfolded springs, which is only affordable
+// there)
+static void bench_tm(Span input) {
+  static const usize factors[] = {5, 100, 1000};
+
+  for (usize f = 0; f < sizeof(factors) / sizeof(factors[0]); f++) {
+    usize k = factors[f];
+    bool check = k <= 100;
+    Unfolded unfolded = {0};
+    if (check) {
+      unfolded = Unfolded_new((input.len + 1) * k, input.len * k);
+    }
+
+    usize lines = 0;
+    usize tm_lines = 0;
+    u64 tm_time = 0;
+    u64 drift_time = 0;
+    u64 dp_time = 0;
+    SpanSplitIterator line_it = Span_split_lines(input);
+    SpanSplitIteratorNext line = SpanSplitIterator_next(&line_it);
+    while (line.valid) {
+      Springs springs = Springs_parse(line.dat);
+
+      u64 start = time_ns();
+      TmArrangements tm = Springs_arrangements_tm(springs, k);
+      tm_time += time_ns() - start;
+
+      u64 arrangements = tm.dat;
+      if (!tm.valid) {
+        start = time_ns();
+        arrangements = Springs_arrangements_drift(springs, k);
+        drift_time += time_ns() - start;
+      }
+
+      lines++;
+      tm_lines += tm.valid;
+      if (check) {
+        start = time_ns();
+        Unfolded_set(&unfolded, springs, k);
+        u64 dp = Unfolded_arrangements(&unfolded);
+        dp_time += time_ns() - start;
+        assert(arrangements == dp);
+      }
+      line = SpanSplitIterator_next(&line_it);
+    }
+
+    printf4("unfold %u: tm %uus for %u/%u lines, ", k, tm_time / 1000,
+            tm_lines, lines);
+    printf2("drift %uus for %u lines", drift_time / 1000, lines - tm_lines);
+    if (check) {
+      printf1(", dp %uus for all\n", dp_time / 1000);
+    } else {
+      printf0("\n");
+    }
+  }
+}
+
 int main(void) {
   Span example = Span_from_str("???.### 1,1,3\n"
                                ".??..??...?##. 1,1,3\n"
@@ -176,5 +790,10 @@ int main(void) {
   Span input = Span_from_file("inputs/day12.txt");
   solve(input);
 
+  if (has_arg("--bench")) {
+    bench(input);
+    bench_tm(input);
+  }
+
   return 0;
 }
@@ -1,131 +1,155 @@
 #include "baz.h"
 
-define_array(Pattern, u32, 32);
+// Patterns up to 256 cells wide and tall, each line (row or column) is a
+// multiword bitset with bit i set for a rock at i
+#define WORDS 4
+#define MAX_LINES (WORDS * 64)
 
-typedef Option(usize) Reflection;
-static Reflection Pattern_reflection(const Pattern *pat, usize discard) {
-  isize len = (isize)pat->len;
+typedef struct {
+  u64 dat[WORDS];
+} Line;
 
-  isize min_overlap = 2;
-  isize bound = len - min_overlap;
+typedef struct {
+  Line dat[MAX_LINES];
+  usize len;
+  usize width;
+} Grid;
+
+static void Grid_push(Grid *grid, Span line) {
+  if (grid->len == 0) {
+    grid->width = line.len;
+  }
+  assert(grid->width == line.len);
+  assert(line.len <= MAX_LINES);
+  assert(grid->len < MAX_LINES);
 
-  for (isize offset = -bound; offset <= bound; offset += 2) {
-    bool reflect = true;
+  Line *row = &grid->dat[grid->len++];
+  memset(row, 0, sizeof(Line));
 
-    for (isize i = 0; i < len; i++) {
-      isize j = i + offset;
-      isize k = (len + offset) - 1 - j;
+  for (usize i = 0; i < line.len; i++) {
+    if (line.dat[i] == '#') {
+      row->dat[i / 64] |= (u64)1 << (i % 64);
+    } else {
+      assert(line.dat[i] == '.');
+    }
+  }
+}
 
-      if (j < 0 || j >= len) {
-        continue;
+// In place transpose of a 64x64 bit-matrix, swapping the off-diagonal
+// blocks of halving size (Hacker's Delight 7-3)
+static void transpose64(u64 a[64]) {
+  u64 m = 0x00000000ffffffff;
+  for (usize j = 32; j != 0; j >>= 1, m ^= m << j) {
+    for (usize k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+      u64 t = ((a[k] >> j) ^ a[k | j]) & m;
+      a[k] ^= t << j;
+      a[k | j] ^= t;
+    }
+  }
+}
+
+// Columns of the grid, one 64x64 block at a time
+static void Grid_transpose(const Grid *rows, Grid *columns) {
+  columns->len = rows->width;
+  columns->width = rows->len;
+
+  usize row_blocks = (rows->len + 63) / 64;
+  usize col_blocks = (rows->width + 63) / 64;
+
+  for (usize c = 0; c < columns->len; c++) {
+    memset(&columns->dat[c], 0, sizeof(Line));
+  }
+
+  for (usize rb = 0; rb < row_blocks; rb++) {
+    for (usize cb = 0; cb < col_blocks; cb++) {
+      u64 block[64] = {0};
+      for (usize i = 0; i < 64 && rb * 64 + i < rows->len; i++) {
+        block[i] = rows->dat[rb * 64 + i].dat[cb];
       }
 
-      assert(k >= 0 && k < len);
+      transpose64(block);
 
-      if (pat->dat[j] != pat->dat[k]) {
-        reflect = false;
-        break;
+      for (usize i = 0; i < 64 && cb * 64 + i < columns->len; i++) {
+        columns->dat[cb * 64 + i].dat[rb] = block[i];
       }
     }
+  }
+}
 
-    if (reflect) {
-      isize reflect = offset + ((len - offset) / 2);
-      assert(reflect >= 0 && reflect < len);
+// Number of cells differing across a mirror placed before line `axis`,
+// stopping early once it goes over `max`
+static usize Grid_mirror_diff(const Grid *grid, usize axis, usize max) {
+  usize words = (grid->width + 63) / 64;
+  usize diff = 0;
 
-      if ((usize)reflect != discard) {
-        return (Reflection){
-            .valid = true,
-            .dat = (usize)reflect,
-        };
-      }
+  for (usize i = axis, j = axis; i > 0 && j < grid->len; i--, j++) {
+    for (usize w = 0; w < words; w++) {
+      u64 x = grid->dat[i - 1].dat[w] ^ grid->dat[j].dat[w];
+      diff += (usize)__builtin_popcountl(x);
+    }
+
+    if (diff > max) {
+      break;
     }
   }
 
-  return (Reflection){
-      .valid = false,
-  };
+  return diff;
 }
 
+// Axis (number of lines before the mirror) of the clean reflection and of the
+// reflection with exactly one smudge, 0 when there is none
 typedef struct {
-  Pattern rows;
-  Pattern columns;
-} Patterns;
+  usize clean;
+  usize smudged;
+} Mirrors;
 
-static void Patterns_clear(Patterns *pat) {
-  pat->rows.len = 0;
-  pat->columns.len = 0;
-}
+static Mirrors Grid_mirrors(const Grid *grid) {
+  Mirrors mirrors = {0};
 
-static void Patterns_push(Patterns *pat, Span line) {
-  if (pat->columns.len == 0) {
-    memset(&pat->columns, 0, sizeof(pat->columns));
-    pat->columns.len = line.len;
-  }
-  assert(pat->columns.len == line.len);
-
-  u16 row = 0;
+  for (usize axis = 1; axis < grid->len; axis++) {
+    usize diff = Grid_mirror_diff(grid, axis, 1);
 
-  for (usize i = 0; i < line.len; i++) {
-    if (line.dat[i] == '#') {
-      row |= (1 << i);
-      pat->columns.dat[i] |= (1 << pat->rows.len);
-    } else {
-      assert(line.dat[i] == '.');
+    if (diff == 0 && mirrors.clean == 0) {
+      mirrors.clean = axis;
+    } else if (diff == 1 && mirrors.smudged == 0) {
+      mirrors.smudged = axis;
     }
   }
 
-  Pattern_push(&pat->rows, row);
+  return mirrors;
 }
 
-typedef Option(usize) Summary;
-static Summary Patterns_summarize(const Patterns *pat, usize discard) {
-  Reflection cols_ref = Pattern_reflection(&pat->columns, discard);
-  if (cols_ref.valid) {
-    return (Summary){
-        .valid = true,
-        .dat = cols_ref.dat,
-    };
-  }
+typedef struct {
+  Grid rows;
+  Grid columns;
+} Patterns;
 
-  Reflection rows_ref = Pattern_reflection(&pat->rows, discard / 100);
-  if (rows_ref.valid) {
-    return (Summary){
-        .valid = true,
-        .dat = 100 * rows_ref.dat,
-    };
+static void Patterns_clear(Patterns *pat) {
+  pat->rows.len = 0;
+  pat->rows.width = 0;
+}
+
+static usize summarize(usize column_axis, usize row_axis) {
+  if (column_axis != 0) {
+    return column_axis;
   }
 
-  return (Summary){
-      .valid = false,
-  };
+  assert(row_axis != 0);
+  return 100 * row_axis;
 }
 
-static usize Patterns_summarize_smudged(const Patterns *pat) {
-  Patterns smuged = {0};
-  Summary r = Patterns_summarize(pat, 0);
-  assert(r.valid);
-
-  for (usize i = 0; i < pat->rows.len; i++) {
-    for (usize j = 0; j < pat->columns.len; j++) {
-      memcpy(&smuged, pat, sizeof(Patterns));
-      bool is_rock = (bool)((smuged.rows.dat[i] >> j) & 1);
-
-      if (is_rock) {
-        smuged.rows.dat[i] &= ~((u32)1 << j);
-        smuged.columns.dat[j] &= ~((u32)1 << i);
-      } else {
-        smuged.rows.dat[i] |= ((u32)1 << j);
-        smuged.columns.dat[j] |= ((u32)1 << i);
-      }
+// Both parts in one pass over the mirror axes of the rows and the columns
+typedef T2(usize, usize) Summary;
+static Summary Patterns_summarize(Patterns *pat) {
+  Grid_transpose(&pat->rows, &pat->columns);
 
-      Summary s = Patterns_summarize(&smuged, r.dat);
-      if (s.valid) {
-        return s.dat;
-      }
-    }
-  }
+  Mirrors rows = Grid_mirrors(&pat->rows);
+  Mirrors columns = Grid_mirrors(&pat->columns);
 
-  panic("Unexpected\n");
+  return (Summary){
+      .fst = summarize(columns.clean, rows.clean),
+      .snd = summarize(columns.smudged, rows.smudged),
+  };
 }
 
 static void solve(Span input) {
@@ -133,24 +157,29 @@ static void solve(Span input) {
 
   usize part1 = 0;
   usize part2 = 0;
-  Patterns pat = {0};
+  // Too big for the stack
+  Patterns *pat = (Patterns *)calloc(1, sizeof(Patterns));
+  phase("solve");
 
   SpanSplitIteratorNext line = SpanSplitIterator_next(&line_it);
   while (line.valid) {
 
     if (line.dat.len > 0) {
-      Patterns_push(&pat, line.dat);
+      Grid_push(&pat->rows, line.dat);
     } else {
-      part1 += UNWRAP(Patterns_summarize(&pat, 0));
-      part2 += Patterns_summarize_smudged(&pat);
-      Patterns_clear(&pat);
+      Summary summary = Patterns_summarize(pat);
+      part1 += summary.fst;
+      part2 += summary.snd;
+      Patterns_clear(pat);
     }
 
     line = SpanSplitIterator_next(&line_it);
   }
 
-  part1 += UNWRAP(Patterns_summarize(&pat, 0));
-  part2 += Patterns_summarize_smudged(&pat);
+  Summary summary = Patterns_summarize(pat);
+  part1 += summary.fst;
+  part2 += summary.snd;
+  phase(NULL);
 
   printf2("%u | %u\n", part1, part2);
 }
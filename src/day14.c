@@ -163,6 +163,7 @@ static void solve(Span input) {
 
   usize part1 = 0;
 
+  phase("parse");
   SpanSplitIteratorNext line = SpanSplitIterator_next(&line_it);
   u8 y = 0;
   usize dims = 0; // Assume square platform
@@ -188,12 +189,14 @@ static void solve(Span input) {
     y++;
   }
 
+  phase("part1");
   Rounds moved = {0};
   Rounds_score(&rounds, dims);
 
   Rounds_tilt_north(&rounds, &moved, &squares, dims);
   part1 = Rounds_score(&moved, dims);
 
+  phase("part2");
   Squares east = {0};
   Squares_rotate(&squares, &east, dims);
   Squares south = {0};
@@ -235,6 +238,7 @@ static void solve(Span input) {
 
     cycle++;
   }
+  phase(NULL);
 
   printf2("%u | %u\n", part1, part2);
 }
@@ -4,11 +4,6 @@ static u8 hash(Span input) {
   u8 x = 0;
 
   for (usize i = 0; i < input.len; i++) {
-    // ignore newline characters
-    if (input.dat[i] == '\n') {
-      continue;
-    }
-
     x += input.dat[i];
     x *= 17;
   }
@@ -16,88 +11,415 @@ static u8 hash(Span input) {
   return x;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Batched HASH
+
+#define LANES 8
+
+typedef int i32x8 __attribute__((vector_size(32)));
+
+// A step of the initialization sequence, as offsets into the input
+typedef struct {
+  u32 start;
+  u32 len;
+  u32 label_len;
+} Step;
+
+typedef struct {
+  u8 step;
+  u8 label;
+} StepHash;
+
+// HASH of LANES steps at once, along with the HASH of their labels. Each lane
+// gathers 4 bytes of its step at a time for as long as the longest step, so a
+// short step may be read well past its end
+static void hash_batch(Span input, const Step *steps, StepHash *out) {
+  i32x8 start;
+  i32x8 len;
+  i32x8 label_len;
+  int max_len = 0;
+
+  for (usize l = 0; l < LANES; l++) {
+    start[l] = (int)steps[l].start;
+    len[l] = (int)steps[l].len;
+    label_len[l] = (int)steps[l].label_len;
+    max_len = len[l] > max_len ? len[l] : max_len;
+  }
+
+  i32x8 zero = {0};
+  i32x8 all = zero - 1;
+  i32x8 h = zero;
+  i32x8 label = zero;
+
+  for (int i = 0; i < max_len; i += 4) {
+    i32x8 words = __builtin_ia32_gathersiv8si(zero, (const int *)input.dat,
+                                              start + i, all, 1);
+
+    for (int k = 0; k < 4; k++) {
+      i32x8 at_label = label_len == i + k;
+      label = (h & at_label) | (label & ~at_label);
+
+      i32x8 byte = (words >> (8 * k)) & 0xff;
+      i32x8 next = ((h + byte) * 17) & 0xff;
+      i32x8 active = len > i + k;
+      h = (next & active) | (h & ~active);
+    }
+  }
+
+  for (usize l = 0; l < LANES; l++) {
+    out[l] = (StepHash){
+        .step = (u8)h[l],
+        .label = (u8)label[l],
+    };
+  }
+}
+
+static StepHash hash_step(Span input, Step step) {
+  return (StepHash){
+      .step = hash(Span_slice(input, step.start, step.start + step.len)),
+      .label = hash(Span_slice(input, step.start, step.start + step.label_len)),
+  };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Lenses
+
+// Lenses in insertion order, across all boxes. A removed lens is left in place
+// as a tombstone (focal length 0), and a label maps to its latest slot, so both
+// operations are O(1) and boxes are unbounded
 typedef struct {
   Span label;
-  u8 value;
-} Entry;
+  u8 box;
+  u8 focal;
+} Slot;
 
-define_array(Box, Entry, 8);
+// Open addressing from label to slot, doubling when half full so it grows with
+// the distinct labels of the input. Entries are never removed, a label whose
+// slot is a tombstone gets a new slot when it is inserted again
+typedef struct {
+  u32 *entries; // slot + 1, 0 when empty
+  usize bits;
+  usize count;
+} LabelIndex;
 
 typedef struct {
-  Box boxes[256];
-} HASHMAP;
+  Slot *slots;
+  usize len;
+  usize capacity;
+  LabelIndex index;
+} Lenses;
+
+#define LABEL_INDEX_BITS 10
 
-static void HASHMAP_insert(HASHMAP *hm, Entry e) {
-  u8 ix = hash(e.label);
-  Box *box = &hm->boxes[ix];
+static Lenses Lenses_new(usize capacity) {
+  assert(capacity < UINT32_MAX);
 
-  for (usize i = 0; i < box->len; i++) {
-    if (Span_eq(&box->dat[i].label, &e.label)) {
-      box->dat[i].value = e.value;
-      return;
+  return (Lenses){
+      .slots = (Slot *)calloc(capacity, sizeof(Slot)),
+      .capacity = capacity,
+      .index =
+          (LabelIndex){
+              .entries =
+                  (u32 *)calloc((usize)1 << LABEL_INDEX_BITS, sizeof(u32)),
+              .bits = LABEL_INDEX_BITS,
+          },
+  };
+}
+
+// Entry of the label, or the empty entry where it would go
+static u32 *LabelIndex_entry(const LabelIndex *index, const Slot *slots,
+                             Span label) {
+  usize mask = ((usize)1 << index->bits) - 1;
+  // The top bits of FxHash are the well mixed ones
+  usize ix = Span_hash(&label) >> (64 - index->bits);
+
+  while (index->entries[ix] != 0 &&
+         !Span_eq(&slots[index->entries[ix] - 1].label, &label)) {
+    ix = (ix + 1) & mask;
+  }
+
+  return &index->entries[ix];
+}
+
+static void LabelIndex_grow(LabelIndex *index, const Slot *slots) {
+  LabelIndex grown = {
+      .entries = (u32 *)calloc((usize)1 << (index->bits + 1), sizeof(u32)),
+      .bits = index->bits + 1,
+      .count = index->count,
+  };
+
+  for (usize i = 0; i < (usize)1 << index->bits; i++) {
+    u32 entry = index->entries[i];
+    if (entry != 0) {
+      *LabelIndex_entry(&grown, slots, slots[entry - 1].label) = entry;
     }
   }
 
-  Box_push(box, e);
+  free(index->entries);
+  *index = grown;
 }
 
-static void HASHMAP_remove(HASHMAP *hm, Span label) {
-  u8 ix = hash(label);
-  Box *box = &hm->boxes[ix];
+static void Lenses_insert(Lenses *lenses, Span label, u8 box, u8 focal) {
+  assert(focal != 0);
+
+  u32 *entry = LabelIndex_entry(&lenses->index, lenses->slots, label);
 
-  for (usize i = 0; i < box->len; i++) {
-    if (Span_eq(&box->dat[i].label, &label)) {
-      Box_remove(box, i);
-      return;
+  if (*entry == 0 || lenses->slots[*entry - 1].focal == 0) {
+    assert(lenses->len < lenses->capacity);
+    lenses->slots[lenses->len++] = (Slot){
+        .label = label,
+        .box = box,
+    };
+
+    if (*entry == 0) {
+      lenses->index.count++;
+    }
+    *entry = (u32)lenses->len;
+
+    if (2 * lenses->index.count > (usize)1 << lenses->index.bits) {
+      LabelIndex_grow(&lenses->index, lenses->slots);
+      entry = LabelIndex_entry(&lenses->index, lenses->slots, label);
     }
   }
+
+  lenses->slots[*entry - 1].focal = focal;
+}
+
+static void Lenses_remove(Lenses *lenses, Span label) {
+  u32 *entry = LabelIndex_entry(&lenses->index, lenses->slots, label);
+
+  if (*entry != 0) {
+    lenses->slots[*entry - 1].focal = 0;
+  }
 }
 
-static usize HASHMAP_focusing_power(const HASHMAP *hm) {
+static usize Lenses_focusing_power(const Lenses *lenses) {
+  usize position[256] = {0};
   usize power = 0;
-  for (usize i = 0; i < 256; i++) {
-    for (usize j = 0; j < hm->boxes[i].len; j++) {
-      power += (1 + i) * (1 + j) * hm->boxes[i].dat[j].value;
+
+  for (usize i = 0; i < lenses->len; i++) {
+    const Slot *slot = &lenses->slots[i];
+    if (slot->focal == 0) {
+      continue;
     }
+
+    position[slot->box] += 1;
+    power += (1 + (usize)slot->box) * position[slot->box] * slot->focal;
   }
 
   return power;
 }
 
-static void solve(Span input) {
-  SpanSplitIterator chunk_it = {
-      .rest = input,
-      .sep = ',',
-  };
+////////////////////////////////////////////////////////////////////////////////
+// Solve
+
+// Apply the steps in order, their hashes already computed
+static void Lenses_apply(Lenses *lenses, Span input, const Step *steps,
+                         const StepHash *hashes, usize len) {
+  for (usize i = 0; i < len; i++) {
+    usize start = steps[i].start;
+    Span step = Span_slice(input, start, start + steps[i].len);
+    Span label = Span_slice(step, 0, steps[i].label_len);
+    u8 op = step.dat[steps[i].label_len];
+
+    if (op == '-') {
+      assert(steps[i].label_len + 1 == step.len);
+      Lenses_remove(lenses, label);
+    } else {
+      assert(op == '=');
+      Span focal = Span_slice(step, steps[i].label_len + 1, step.len);
+      u8 value = (u8)UNWRAP(Span_parse_u64(focal, 10)).fst;
+      Lenses_insert(lenses, label, hashes[i].label, value);
+    }
+  }
+}
+
+typedef T2(usize, usize) Parts;
+
+// Newlines are ignored wherever they are in the sequence. They're only
+// expected at its end, so when there are others the input is copied without
+// them, going from one to the next with the index
+static Span strip_newlines(Span input, const StructIndex *index) {
+  u8 *dat = (u8 *)calloc(input.len, sizeof(u8));
+  usize len = 0;
+  usize start = 0;
+
+  StructIter newline_it = StructIndex_iter(index, STRUCT_NEWLINE);
+  StructIterNext newline = StructIter_next(&newline_it);
+  while (newline.valid) {
+    memcpy(&dat[len], &input.dat[start], newline.dat - start);
+    len += newline.dat - start;
+    start = newline.dat + 1;
+    newline = StructIter_next(&newline_it);
+  }
+  memcpy(&dat[len], &input.dat[start], input.len - start);
+  len += input.len - start;
+
+  return (Span){.dat = dat, .len = len};
+}
 
+// Batching can be turned off, to compare in the benchmark
+static Parts run(Span input, bool batched) {
+  input = Span_trim_end_whitespace(input);
+  // Gather offsets are 32-bit
+  assert(input.len < INT32_MAX);
+
+  // Steps are separated by commas and have one operator, the index lists
+  // them alternately
+  StructIndex index = StructIndex_new(input, ",=-");
+  if (StructIndex_next(&index, STRUCT_NEWLINE, 0, true) < input.len) {
+    input = strip_newlines(input, &index);
+    index = StructIndex_new(input, ",=-");
+  }
+  StructIter struct_it = StructIndex_iter(&index, STRUCT_CLASS);
+
+  // Shortest step is "a-" followed by a comma
+  Lenses lenses = Lenses_new(input.len / 3 + 1);
   usize part1 = 0;
-  HASHMAP hm = {0};
-
-  SpanSplitIteratorNext chunk = SpanSplitIterator_next(&chunk_it);
-  while (chunk.valid) {
-    part1 += (usize)hash(chunk.dat);
-
-    SpanSplitOn remove = Span_split_on('-', chunk.dat);
-    SpanSplitOn insert = Span_split_on('=', chunk.dat);
-
-    if (remove.valid) {
-      HASHMAP_remove(&hm, remove.dat.fst);
-    } else if (insert.valid) {
-      Entry e = {
-          .label = insert.dat.fst,
-          .value = (u8)UNWRAP(Span_parse_u64(insert.dat.snd, 10)).fst,
-      };
-      HASHMAP_insert(&hm, e);
+
+  Step steps[LANES];
+  StepHash hashes[LANES];
+  usize len = 0;
+
+  usize start = 0;
+  StructIterNext op = StructIter_next(&struct_it);
+  while (op.valid) {
+    assert(input.dat[op.dat] != ',');
+
+    StructIterNext comma = StructIter_next(&struct_it);
+    usize end = comma.valid ? comma.dat : input.len;
+    assert(end == input.len || input.dat[end] == ',');
+
+    steps[len++] = (Step){
+        .start = (u32)start,
+        .len = (u32)(end - start),
+        .label_len = (u32)(op.dat - start),
+    };
+
+    if (len == LANES) {
+      // Every lane gathers as many words as the longest step needs, so the
+      // last lane reads up to its start plus that length rounded up to a
+      // word. Only the final batches can reach the end of the input
+      u32 max_len = 0;
+      for (usize i = 0; i < LANES; i++) {
+        max_len = steps[i].len > max_len ? steps[i].len : max_len;
+      }
+
+      if (batched &&
+          steps[LANES - 1].start + ((max_len + 3) & ~3u) <= input.len) {
+        hash_batch(input, steps, hashes);
+      } else {
+        for (usize i = 0; i < len; i++) {
+          hashes[i] = hash_step(input, steps[i]);
+        }
+      }
+
+      for (usize i = 0; i < len; i++) {
+        part1 += hashes[i].step;
+      }
+      Lenses_apply(&lenses, input, steps, hashes, len);
+      len = 0;
+    }
+
+    start = end + 1;
+    op = StructIter_next(&struct_it);
+  }
+
+  for (usize i = 0; i < len; i++) {
+    hashes[i] = hash_step(input, steps[i]);
+    part1 += hashes[i].step;
+  }
+  Lenses_apply(&lenses, input, steps, hashes, len);
+
+  usize part2 = Lenses_focusing_power(&lenses);
+
+  return (Parts){.fst = part1, .snd = part2};
+}
+
+static void solve(Span input) {
+  phase("solve");
+  Parts parts = run(input, true);
+  phase(NULL);
+  printf2("%u | %u\n", parts.fst, parts.snd);
+}
+
+// A batch whose last step is short but another is long, ending right before
+// an unmapped page: the gathers of the last lane must stay in the input
+static void check_page_end(void) {
+  usize page = 4096;
+  u8 *pages = (u8 *)calloc(2, page);
+  isize ret = sys_mprotect(&pages[page], page, PROT_NONE);
+  assert(ret == 0);
+
+  Span steps = Span_from_str(
+      "abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyzabcdefgh=1,"
+      "a-,b-,c-,d-,e-,f-,x-,y-");
+  u8 *dat = &pages[page - steps.len];
+  memcpy(dat, steps.dat, steps.len);
+  Span input = {.dat = dat, .len = steps.len};
+
+  Parts scalar = run(input, false);
+  Parts batched = run(input, true);
+  assert(scalar.fst == batched.fst && scalar.snd == batched.snd);
+}
+
+// Newlines within the sequence, even within a step, are ignored
+static void check_newlines(void) {
+  Span flat =
+      Span_from_str("rn=1,cm-,qp=3,cm=2,qp-,pc=4,ot=9,ab=5,pc-,pc=6,ot=7\n");
+  Span broken = Span_from_str(
+      "rn=1,cm-,qp=3,\ncm=2,qp-,p\nc=4,ot=\n9,ab=5,pc-\n,pc=6,ot=7\n");
+
+  Parts expected = run(flat, true);
+  Parts parts = run(broken, true);
+  assert(parts.fst == expected.fst && parts.snd == expected.snd);
+  assert(expected.fst == 1320 && expected.snd == 145);
+}
+
+// Millions of steps over many distinct labels, far more lenses per box than
+// the puzzle input
+static void bench(void) {
+  u64 state = RAND_SEED;
+  usize steps = 4 * 1000 * 1000;
+  usize labels = 64 * 1024;
+
+  u8 *text = (u8 *)calloc(steps * 12, sizeof(u8));
+  usize len = 0;
+
+  for (usize i = 0; i < steps; i++) {
+    // Labels are picked from a fixed pool by seeding a generator with the
+    // label number
+    u64 label_state = rand_next(&state) % labels + 1;
+    usize label_len = 2 + rand_next(&label_state) % 7;
+    for (usize j = 0; j < label_len; j++) {
+      text[len++] = (u8)('a' + rand_next(&label_state) % 26);
+    }
+
+    if (rand_next(&state) % 2 == 0) {
+      text[len++] = '-';
     } else {
-      panic("Unexpected\n");
+      text[len++] = '=';
+      text[len++] = (u8)('1' + rand_next(&state) % 9);
     }
 
-    chunk = SpanSplitIterator_next(&chunk_it);
+    text[len++] = ',';
   }
+  text[len - 1] = '\n';
+
+  Span input = {.dat = text, .len = len};
 
-  usize part2 = HASHMAP_focusing_power(&hm);
+  u64 scalar_start = time_ns();
+  Parts scalar = run(input, false);
+  u64 scalar_time = time_ns() - scalar_start;
 
-  printf2("%u | %u\n", part1, part2);
+  u64 batched_start = time_ns();
+  Parts batched = run(input, true);
+  u64 batched_time = time_ns() - batched_start;
+
+  assert(scalar.fst == batched.fst && scalar.snd == batched.snd);
+  printf3("%u steps (%u | %u)\n", steps, batched.fst, batched.snd);
+  printf2("scalar %uus | batched %uus\n", scalar_time / 1000,
+          batched_time / 1000);
 }
 
 int main(void) {
@@ -106,9 +428,15 @@ int main(void) {
   Span example =
       Span_from_str("rn=1,cm-,qp=3,cm=2,qp-,pc=4,ot=9,ab=5,pc-,pc=6,ot=7");
   solve(example);
+  check_page_end();
+  check_newlines();
 
   Span input = Span_from_file("inputs/day15.txt");
   solve(input);
 
+  if (has_arg("--bench")) {
+    bench();
+  }
+
   return 0;
 }
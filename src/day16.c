@@ -1,12 +1,14 @@
 #include "baz.h"
 
+// Coordinates are 32-bit to keep the worklists compact, grids are at most
+// UINT32_MAX wide
 typedef struct {
-  u8 x;
-  u8 y;
+  u32 x;
+  u32 y;
 } Pos;
 
-static inline usize Pos_index(Pos pos, u8 dim) {
-  return (usize)pos.x + (((usize)dim + 1) * (usize)pos.y);
+static inline usize Pos_index(Pos pos, usize dim) {
+  return (usize)pos.x + ((dim + 1) * (usize)pos.y);
 }
 
 typedef struct {
@@ -14,20 +16,8 @@ typedef struct {
   u8 dir;
 } State;
 
-static Hash State_hash(const State *state) {
-  FxHasher hasher = {0};
-  FxHasher_add(&hasher, (usize)state->dir);
-  FxHasher_add(&hasher, (usize)state->pos.x);
-  FxHasher_add(&hasher, (usize)state->pos.y);
-  return hasher;
-}
-
-static bool State_eq(const State *a, const State *b) {
-  return a->dir == b->dir && a->pos.x == b->pos.x && a->pos.y == b->pos.y;
-}
-
 typedef Option(State) NextState;
-static NextState State_next(State state, u8 dim) {
+static NextState State_next(State state, usize dim) {
   switch (state.dir) {
   case 0:
     // UP
@@ -64,182 +54,523 @@ static NextState State_next(State state, u8 dim) {
   return (NextState){.valid = true, .dat = state};
 }
 
-define_array(ToVisit, State, 256);
-define_hash_map(Visited, usize, u8, (16 * 1024), usize_hash, usize_eq);
-define_hash_map(VisitedState, State, u8, (16 * 1024), State_hash, State_eq);
+// Starting state for the beam entering the grid on the edge facing direction
+// d, at offset o along that edge
+static State State_start(usize o, u8 d, usize dim) {
+  State start = {
+      .pos = {.x = 0, .y = 0},
+      .dir = d,
+  };
+  switch (d) {
+  case 0:
+    // UP (start from bottom)
+    start.pos.x = (u32)o;
+    start.pos.y = (u32)(dim - 1);
+    break;
+  case 1:
+    // RIGHT (start from left)
+    start.pos.y = (u32)o;
+    break;
+  case 2:
+    // DOWN (start from top)
+    start.pos.x = (u32)o;
+    break;
+  case 3:
+    // LEFT (start from right)
+    start.pos.x = (u32)(dim - 1);
+    start.pos.y = (u32)o;
+    break;
+  default:
+    panic("Unexpected\n");
+  }
 
-static void solve(Span input) {
-  // Assume square
-  u8 dim = (u8)UNWRAP(Span_split_on('\n', input)).fst.len;
-  usize part1 = 0;
-  usize part2 = 0;
+  return start;
+}
 
-  for (u8 o = 0; o < dim; o++) {
-    for (u8 d = 0; d < 4; d++) {
-      Visited visited = {0};
-      VisitedState visited_state = {0};
-      ToVisit to_visit = {0};
-
-      State start = {
-          .pos = {.x = 0, .y = 0},
-          .dir = d,
-      };
-      switch (d) {
+// Dense visited set for a single beam: a 4 bit direction mask per cell, reset
+// in O(touched) through the list of dirty cells
+typedef struct {
+  usize dim;
+  usize cells;
+  u8 *dirs;        // [cells] directions a beam entered each cell with
+  usize *dirty;    // [cells] cells with non-zero dirs
+  usize dirty_len; // also the number of energised cells
+  State *to_visit; // [cells * 8 + 1] every state pushes at most 2 states
+  usize to_visit_len;
+} Energiser;
+
+static Energiser Energiser_new(usize dim) {
+  usize cells = (dim + 1) * dim;
+  return (Energiser){
+      .dim = dim,
+      .cells = cells,
+      .dirs = (u8 *)calloc(cells, sizeof(u8)),
+      .dirty = (usize *)calloc(cells, sizeof(usize)),
+      .dirty_len = 0,
+      .to_visit = (State *)calloc(cells * 8 + 1, sizeof(State)),
+      .to_visit_len = 0,
+  };
+}
+
+static void Energiser_reset(Energiser *energiser) {
+  for (usize i = 0; i < energiser->dirty_len; i++) {
+    energiser->dirs[energiser->dirty[i]] = 0;
+  }
+  energiser->dirty_len = 0;
+  energiser->to_visit_len = 0;
+}
+
+static inline void Energiser_push(Energiser *energiser, State state) {
+  assert(energiser->to_visit_len < energiser->cells * 8 + 1);
+  energiser->to_visit[energiser->to_visit_len++] = state;
+}
+
+// Number of energised tiles for a single beam entering the grid at start
+static usize State_energised(Energiser *energiser, Span input, State start) {
+  usize dim = energiser->dim;
+  Energiser_reset(energiser);
+  Energiser_push(energiser, start);
+
+  while (energiser->to_visit_len > 0) {
+    State current = energiser->to_visit[--energiser->to_visit_len];
+    usize cell = Pos_index(current.pos, dim);
+    u8 dir_bit = (u8)(1 << current.dir);
+
+    if (energiser->dirs[cell] & dir_bit) {
+      continue;
+    }
+
+    if (energiser->dirs[cell] == 0) {
+      energiser->dirty[energiser->dirty_len++] = cell;
+    }
+    energiser->dirs[cell] |= dir_bit;
+
+    switch (input.dat[cell]) {
+    case '.': {
+      // continue straight
+      NextState next = State_next(current, dim);
+      if (next.valid) {
+        Energiser_push(energiser, next.dat);
+      }
+      break;
+    }
+    case '\\': {
+      switch (current.dir) {
       case 0:
-        // UP (start from bottom)
-        start.pos.x = o;
-        start.pos.y = dim - 1;
+        current.dir = 3;
         break;
       case 1:
-        // RIGHT (start from left)
-        start.pos.y = o;
+        current.dir = 2;
         break;
       case 2:
-        // DOWN (start from top)
-        start.pos.x = o;
+        current.dir = 1;
         break;
       case 3:
-        // LEFT (start from right)
-        start.pos.x = dim - 1;
-        start.pos.y = o;
+        current.dir = 0;
         break;
       default:
         panic("Unexpected\n");
       }
-
-      ToVisit_push(&to_visit, start);
-
-      ToVisitPop current = ToVisit_pop(&to_visit);
-      while (current.valid) {
-        if (VisitedState_contains(&visited_state, &current.dat)) {
-          current = ToVisit_pop(&to_visit);
-          continue;
-        }
-
-        VisitedState_insert(&visited_state, current.dat, 0);
-        Visited_insert(&visited, Pos_index(current.dat.pos, dim),
-                       current.dat.dir);
-
-        switch (input.dat[Pos_index(current.dat.pos, dim)]) {
-        case '.': {
-          // continue straight
-          NextState next = State_next(current.dat, dim);
+      NextState next = State_next(current, dim);
+      if (next.valid) {
+        Energiser_push(energiser, next.dat);
+      }
+      break;
+    }
+    case '/':
+      switch (current.dir) {
+      case 0:
+        current.dir = 1;
+        break;
+      case 1:
+        current.dir = 0;
+        break;
+      case 2:
+        current.dir = 3;
+        break;
+      case 3:
+        current.dir = 2;
+        break;
+      default:
+        panic("Unexpected\n");
+      }
+      NextState next = State_next(current, dim);
+      if (next.valid) {
+        Energiser_push(energiser, next.dat);
+      }
+      break;
+    case '|':
+      if (current.dir == 1 || current.dir == 3) {
+        current.dir = 0;
+        {
+          NextState next = State_next(current, dim);
           if (next.valid) {
-            ToVisit_push(&to_visit, next.dat);
+            Energiser_push(energiser, next.dat);
           }
-          break;
         }
-        case '\\': {
-          switch (current.dat.dir) {
-          case 0:
-            current.dat.dir = 3;
-            break;
-          case 1:
-            current.dat.dir = 2;
-            break;
-          case 2:
-            current.dat.dir = 1;
-            break;
-          case 3:
-            current.dat.dir = 0;
-            break;
-          default:
-            panic("Unexpected\n");
-          }
-          NextState next = State_next(current.dat, dim);
+        current.dir = 2;
+        {
+          NextState next = State_next(current, dim);
           if (next.valid) {
-            ToVisit_push(&to_visit, next.dat);
+            Energiser_push(energiser, next.dat);
           }
-          break;
         }
-        case '/':
-          switch (current.dat.dir) {
-          case 0:
-            current.dat.dir = 1;
-            break;
-          case 1:
-            current.dat.dir = 0;
-            break;
-          case 2:
-            current.dat.dir = 3;
-            break;
-          case 3:
-            current.dat.dir = 2;
-            break;
-          default:
-            panic("Unexpected\n");
-          }
-          NextState next = State_next(current.dat, dim);
+      } else {
+        // continue straight
+        NextState next = State_next(current, dim);
+        if (next.valid) {
+          Energiser_push(energiser, next.dat);
+        }
+      }
+      break;
+    case '-':
+      if (current.dir == 0 || current.dir == 2) {
+        current.dir = 1;
+        {
+          NextState next = State_next(current, dim);
           if (next.valid) {
-            ToVisit_push(&to_visit, next.dat);
-          }
-          break;
-        case '|':
-          if (current.dat.dir == 1 || current.dat.dir == 3) {
-            current.dat.dir = 0;
-            {
-              NextState next = State_next(current.dat, dim);
-              if (next.valid) {
-                ToVisit_push(&to_visit, next.dat);
-              }
-            }
-            current.dat.dir = 2;
-            {
-              NextState next = State_next(current.dat, dim);
-              if (next.valid) {
-                ToVisit_push(&to_visit, next.dat);
-              }
-            }
-          } else {
-            // continue straight
-            NextState next = State_next(current.dat, dim);
-            if (next.valid) {
-              ToVisit_push(&to_visit, next.dat);
-            }
+            Energiser_push(energiser, next.dat);
           }
-          break;
-        case '-':
-          if (current.dat.dir == 0 || current.dat.dir == 2) {
-            current.dat.dir = 1;
-            {
-              NextState next = State_next(current.dat, dim);
-              if (next.valid) {
-                ToVisit_push(&to_visit, next.dat);
-              }
-            }
-            current.dat.dir = 3;
-            {
-              NextState next = State_next(current.dat, dim);
-              if (next.valid) {
-                ToVisit_push(&to_visit, next.dat);
-              }
-            }
-          } else {
-            // continue straight
-            NextState next = State_next(current.dat, dim);
-            if (next.valid) {
-              ToVisit_push(&to_visit, next.dat);
-            }
+        }
+        current.dir = 3;
+        {
+          NextState next = State_next(current, dim);
+          if (next.valid) {
+            Energiser_push(energiser, next.dat);
           }
-          break;
-        default:
-          panic("Unexpected\n");
         }
+      } else {
+        // continue straight
+        NextState next = State_next(current, dim);
+        if (next.valid) {
+          Energiser_push(energiser, next.dat);
+        }
+      }
+      break;
+    default:
+      panic("Unexpected\n");
+    }
+  }
+
+  return energiser->dirty_len;
+}
+
+// Most energised tiles over every entry beam, one at a time through the same
+// Energiser. The benchmark checks the bit-sliced engine against it
+static usize Energiser_max_energised(Energiser *energiser, Span input) {
+  usize max = 0;
+  for (usize k = 0; k < energiser->dim * 4; k++) {
+    State start = State_start(k / 4, (u8)(k % 4), energiser->dim);
+    usize count = State_energised(energiser, input, start);
+    max = count > max ? count : max;
+  }
+  return max;
+}
+
+// Bit-sliced engine: simulate LANES entry beams at once, one per bit lane.
+// Each (cell, dir) state holds the mask of the beams which enter it, and it
+// only propagates once that mask is complete. Beams loop, so the sweep goes
+// over the strongly connected components of the state graph in topological
+// order: every state of a component is entered by the same beams, and a
+// component has all of its beams once the components before it are done. A
+// batch of beams then costs one pass over the states, however long and shared
+// their paths are.
+
+typedef u64 u64x4 __attribute__((vector_size(32)));
+#define LANES 256
+#define NO_STATE UINT32_MAX
+
+// Outgoing directions (as a bitmask) of a beam entering tile with dir
+static u8 tile_out_dirs(u8 tile, u8 dir) {
+  static const u8 backslash[4] = {1 << 3, 1 << 2, 1 << 1, 1 << 0};
+  static const u8 slash[4] = {1 << 1, 1 << 0, 1 << 3, 1 << 2};
+
+  switch (tile) {
+  case '.':
+    return (u8)(1 << dir);
+  case '\\':
+    return backslash[dir];
+  case '/':
+    return slash[dir];
+  case '|':
+    return (dir == 1 || dir == 3) ? (1 << 0) | (1 << 2) : (u8)(1 << dir);
+  case '-':
+    return (dir == 0 || dir == 2) ? (1 << 1) | (1 << 3) : (u8)(1 << dir);
+  default:
+    panic("Unexpected\n");
+  }
+}
+
+// States are numbered cell * 4 + dir, components in the order Tarjan's
+// algorithm finds them, which is reverse topological: the states a component
+// leads to are in components numbered below it
+typedef struct {
+  usize dim;
+  usize states;
+  u32 (*next)[2]; // [states] up to 2 next states, NO_STATE otherwise
+  u32 *comp;      // [states]
+  u32 *members;   // [states] states grouped by component
+  u32 *comp_end;  // [comps] end of the component in members
+  usize comps;
+  u64x4 *lanes; // [comps] beams entering the component
+  // Bit-sliced per lane counters: bit i of lane l is bit l of counter[i]
+  u64x4 counter[64];
+} Beams;
+
+static inline State State_of(u32 state, usize dim) {
+  usize cell = state / 4;
+  return (State){
+      .pos = {.x = (u32)(cell % (dim + 1)), .y = (u32)(cell / (dim + 1))},
+      .dir = (u8)(state % 4),
+  };
+}
+
+static inline u32 State_id(State state, usize dim) {
+  return (u32)(Pos_index(state.pos, dim) * 4 + state.dir);
+}
+
+// Tarjan's algorithm, iterative as the paths can be as long as the grid
+static void Beams_components(Beams *beams) {
+  usize states = beams->states;
+  u32 *index = (u32 *)calloc(states, sizeof(u32)); // 1 based, 0 unvisited
+  u32 *low = (u32 *)calloc(states, sizeof(u32));
+  u8 *on_stack = (u8 *)calloc(states, sizeof(u8));
+  u32 *stack = (u32 *)calloc(states, sizeof(u32));
+  // DFS path, with the next edge to follow from each state
+  u32 *path = (u32 *)calloc(states, sizeof(u32));
+  u8 *edge = (u8 *)calloc(states, sizeof(u8));
+  usize stack_len = 0;
+  usize members_len = 0;
+  u32 next_index = 1;
+
+  for (u32 root = 0; root < states; root++) {
+    if (index[root] != 0 || beams->next[root][0] == NO_STATE) {
+      continue;
+    }
+
+    usize path_len = 0;
+    path[path_len++] = root;
+    index[root] = low[root] = next_index++;
+    stack[stack_len++] = root;
+    on_stack[root] = 1;
+    edge[root] = 0;
+
+    while (path_len > 0) {
+      u32 v = path[path_len - 1];
+
+      if (edge[v] < 2 && beams->next[v][edge[v]] != NO_STATE) {
+        u32 w = beams->next[v][edge[v]++];
+        if (index[w] == 0) {
+          path[path_len++] = w;
+          index[w] = low[w] = next_index++;
+          stack[stack_len++] = w;
+          on_stack[w] = 1;
+          edge[w] = 0;
+        } else if (on_stack[w]) {
+          low[v] = index[w] < low[v] ? index[w] : low[v];
+        }
+        continue;
+      }
 
-        current = ToVisit_pop(&to_visit);
+      path_len--;
+      if (path_len > 0) {
+        u32 parent = path[path_len - 1];
+        low[parent] = low[v] < low[parent] ? low[v] : low[parent];
       }
 
-      if (o == 0 && d == 1) {
-        part1 = visited.count;
+      if (low[v] == index[v]) {
+        u32 w;
+        do {
+          w = stack[--stack_len];
+          on_stack[w] = 0;
+          beams->comp[w] = (u32)beams->comps;
+          beams->members[members_len++] = w;
+        } while (w != v);
+        beams->comp_end[beams->comps++] = (u32)members_len;
+      }
+    }
+  }
+
+  free(index);
+  free(low);
+  free(on_stack);
+  free(stack);
+  free(path);
+  free(edge);
+}
+
+// Every state of a tile leads somewhere (or out of the grid), only the states
+// of the newline column have no next state at all, and are left out
+static Beams Beams_new(Span input, usize dim) {
+  usize states = (dim + 1) * dim * 4;
+  assert(states < NO_STATE);
+
+  Beams beams = {
+      .dim = dim,
+      .states = states,
+      .next = (u32(*)[2])calloc(states, sizeof(u32[2])),
+      .comp = (u32 *)calloc(states, sizeof(u32)),
+      .members = (u32 *)calloc(states, sizeof(u32)),
+      .comp_end = (u32 *)calloc(states, sizeof(u32)),
+      .comps = 0,
+  };
+
+  for (u32 state = 0; state < states; state++) {
+    beams.next[state][0] = beams.next[state][1] = NO_STATE;
+    State current = State_of(state, dim);
+    if (current.pos.x == dim) {
+      continue;
+    }
+
+    // A beam leaving the grid goes to itself, so that every tile state has a
+    // next state. It only adds the state to its own component
+    usize n = 0;
+    u8 out = tile_out_dirs(input.dat[state / 4], current.dir);
+    for (u8 d = 0; d < 4; d++) {
+      if ((out >> d) & 1) {
+        NextState next = State_next((State){.pos = current.pos, .dir = d}, dim);
+        beams.next[state][n++] = next.valid ? State_id(next.dat, dim) : state;
+      }
+    }
+  }
+
+  Beams_components(&beams);
+  beams.lanes = (u64x4 *)calloc(beams.comps, sizeof(u64x4));
+
+  return beams;
+}
+
+// Propagate the beams entering each component to the components it leads to,
+// from the first in topological order (the highest numbered) to the last
+static void Beams_run(Beams *beams) {
+  for (usize c = beams->comps; c-- > 0;) {
+    u64x4 lanes = beams->lanes[c];
+    if ((lanes[0] | lanes[1] | lanes[2] | lanes[3]) == 0) {
+      continue;
+    }
+
+    for (usize m = c == 0 ? 0 : beams->comp_end[c - 1]; m < beams->comp_end[c];
+         m++) {
+      u32 state = beams->members[m];
+      for (usize e = 0; e < 2 && beams->next[state][e] != NO_STATE; e++) {
+        beams->lanes[beams->comp[beams->next[state][e]]] |= lanes;
       }
+    }
+  }
+}
+
+// Add the energised cells into the per lane counters and reset the lanes
+static void Beams_collect(Beams *beams) {
+  memset(beams->counter, 0, sizeof(beams->counter));
 
-      part2 = visited.count > part2 ? visited.count : part2;
+  for (usize cell = 0; cell < beams->states / 4; cell++) {
+    if (beams->next[cell * 4][0] == NO_STATE) {
+      continue;
+    }
+
+    u64x4 carry = beams->lanes[beams->comp[cell * 4]] |
+                  beams->lanes[beams->comp[cell * 4 + 1]] |
+                  beams->lanes[beams->comp[cell * 4 + 2]] |
+                  beams->lanes[beams->comp[cell * 4 + 3]];
+    for (usize i = 0; (carry[0] | carry[1] | carry[2] | carry[3]) != 0; i++) {
+      u64x4 next_carry = beams->counter[i] & carry;
+      beams->counter[i] ^= carry;
+      carry = next_carry;
     }
   }
 
+  memset(beams->lanes, 0, beams->comps * sizeof(u64x4));
+}
+
+static usize Beams_count(const Beams *beams, usize lane) {
+  usize count = 0;
+  for (usize i = 0; i < 64; i++) {
+    count |= (usize)((beams->counter[i][lane / 64] >> (lane % 64)) & 1) << i;
+  }
+  return count;
+}
+
+// Most energised tiles over every entry beam, simulated LANES at a time
+static usize Beams_max_energised(Beams *beams) {
+  usize starts = beams->dim * 4;
+  usize max = 0;
+
+  for (usize batch = 0; batch < starts; batch += LANES) {
+    usize lanes = starts - batch < LANES ? starts - batch : LANES;
+
+    for (usize lane = 0; lane < lanes; lane++) {
+      usize k = batch + lane;
+      State start = State_start(k / 4, (u8)(k % 4), beams->dim);
+      u32 comp = beams->comp[State_id(start, beams->dim)];
+      beams->lanes[comp][lane / 64] |= (u64)1 << (lane % 64);
+    }
+
+    Beams_run(beams);
+    Beams_collect(beams);
+
+    for (usize lane = 0; lane < lanes; lane++) {
+      usize count = Beams_count(beams, lane);
+      max = count > max ? count : max;
+    }
+  }
+
+  return max;
+}
+
+// Assume square
+static usize grid_dim(Span input) {
+  usize dim = UNWRAP(Span_split_on('\n', input)).fst.len;
+  assert(dim < UINT32_MAX);
+  return dim;
+}
+
+static void solve(Span input) {
+  usize dim = grid_dim(input);
+
+  phase("part1");
+  Energiser energiser = Energiser_new(dim);
+  usize part1 = State_energised(&energiser, input, State_start(0, 1, dim));
+  phase("part2");
+  Beams beams = Beams_new(input, dim);
+  usize part2 = Beams_max_energised(&beams);
+  phase(NULL);
+
   printf2("%u | %u\n", part1, part2);
 }
 
+// Part 2 on a grid well past 255 wide, single beams against the bit-sliced
+// engine
+static void bench(void) {
+  static const char tiles[] = "/\\|-";
+  u64 state = RAND_SEED;
+  usize dim = 300;
+
+  u8 *text = (u8 *)calloc((dim + 1) * dim, sizeof(u8));
+  for (usize y = 0; y < dim; y++) {
+    for (usize x = 0; x < dim; x++) {
+      u64 r = rand_next(&state);
+      text[y * (dim + 1) + x] = r % 16 == 0 ? (u8)tiles[(r >> 8) % 4] : '.';
+    }
+    text[y * (dim + 1) + dim] = '\n';
+  }
+  Span input = {.dat = text, .len = (dim + 1) * dim};
+
+  u64 single_start = time_ns();
+  Energiser energiser = Energiser_new(dim);
+  usize single = Energiser_max_energised(&energiser, input);
+  u64 single_time = time_ns() - single_start;
+
+  u64 sliced_start = time_ns();
+  Beams beams = Beams_new(input, dim);
+  usize sliced = Beams_max_energised(&beams);
+  u64 sliced_time = time_ns() - sliced_start;
+
+  assert(single == sliced);
+  printf3("%ux%u grid: %u\n", dim, dim, sliced);
+  printf2("single beams %uus | bit-sliced %uus\n", single_time / 1000,
+          sliced_time / 1000);
+}
+
 int main(void) {
   Span example = Span_from_str(".|...\\....\n"
                                "|.-.\\.....\n"
@@ -257,5 +588,9 @@ int main(void) {
   Span input = Span_from_file("inputs/day16.txt");
   solve(input);
 
+  if (has_arg("--bench")) {
+    bench();
+  }
+
   return 0;
 }
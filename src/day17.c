@@ -112,6 +112,7 @@ static Prevs prevs;
 #endif // DEBUG
 
 static void solve(Span input, u8 straight_min, u8 straight_max) {
+  phase("parse");
   SpanSplitIterator line_it = Span_split_lines(input);
 
   Grid grid = {0};
@@ -124,6 +125,7 @@ static void solve(Span input, u8 straight_min, u8 straight_max) {
     line = SpanSplitIterator_next(&line_it);
   }
 
+  phase("search");
   usize best_heat_loss = 0;
   {
     PriorityQueue pq = {0};
@@ -298,6 +300,7 @@ static void solve(Span input, u8 straight_min, u8 straight_max) {
     }
 #endif // DEBUG
   }
+  phase(NULL);
 
   printf1("%u\n", best_heat_loss);
 }
@@ -5,90 +5,249 @@ typedef struct {
   i64 y;
 } Pos;
 
-static void solve(Span input) {
-  SpanSplitIterator line_it = Span_split_lines(input);
+// A trench dug from the origin: where it ends, its length and its shoelace
+// sum. Long generated plans overflow i64 in the cross products, hence i128
+typedef struct {
+  Pos end;
+  u64 perimeter;
+  i128 total;
+} Trench;
+
+// Directions as encoded in the colours: right, down, left, up
+static void Trench_dig(Trench *trench, u64 dir, u64 dist) {
+  Pos previous = trench->end;
+  Pos *current = &trench->end;
+
+  switch (dir) {
+  case 0:
+    current->x += (i64)dist;
+    break;
+  case 1:
+    current->y += (i64)dist;
+    break;
+  case 2:
+    current->x -= (i64)dist;
+    break;
+  case 3:
+    current->y -= (i64)dist;
+    break;
+  default:
+    panic("Unexpected\n");
+  }
+
+  trench->perimeter += dist;
+  trench->total +=
+      (i128)current->y * previous.x - (i128)current->x * previous.y;
+}
+
+// Trench b dug on from the end of trench a. Moving every point of b by a.end
+// only adds a.end x b.end to its shoelace sum, as the cross terms telescope
+static Trench Trench_append(Trench a, Trench b) {
+  return (Trench){
+      .end = {.x = a.end.x + b.end.x, .y = a.end.y + b.end.y},
+      .perimeter = a.perimeter + b.perimeter,
+      .total = a.total + b.total + (i128)a.end.x * b.end.y -
+               (i128)a.end.y * b.end.x,
+  };
+}
 
-  Pos current1 = {.x = 0, .y = 0};
-  Pos previous1 = current1;
+static u128 Trench_lagoon(Trench trench) {
+  // shoelace algorithm
+  u128 area = (u128)(trench.total < 0 ? -trench.total : trench.total) / 2;
 
-  usize perimeter1 = 0;
-  i64 total1 = 0;
+  // pick's theorem
+  return area + (trench.perimeter / 2) + 1;
+}
 
-  Pos current2 = {.x = 0, .y = 0};
-  Pos previous2 = current2;
+typedef struct {
+  Trench part1;
+  Trench part2;
+} Plan;
 
-  usize perimeter2 = 0;
-  i64 total2 = 0;
+static Plan Plan_dig(Span input) {
+  SpanSplitIterator line_it = Span_split_lines(input);
+  Plan plan = {0};
 
   SpanSplitIteratorNext line = SpanSplitIterator_next(&line_it);
   while (line.valid) {
+    if (line.dat.len == 0) {
+      line = SpanSplitIterator_next(&line_it);
+      continue;
+    }
 
-    usize dist1 =
+    u64 dist1 =
         UNWRAP(Span_parse_u64(Span_slice(line.dat, 2, line.dat.len), 10)).fst;
-    perimeter1 += dist1;
 
+    u64 dir1;
     switch (line.dat.dat[0]) {
-    case 'U':
-      current1.y -= (i64)dist1;
-      break;
     case 'R':
-      current1.x += (i64)dist1;
+      dir1 = 0;
       break;
     case 'D':
-      current1.y += (i64)dist1;
+      dir1 = 1;
       break;
     case 'L':
-      current1.x -= (i64)dist1;
+      dir1 = 2;
+      break;
+    case 'U':
+      dir1 = 3;
       break;
     default:
       panic("Unexpected\n");
     }
 
-    total1 +=
-        (i64)current1.y * (i64)previous1.x - (i64)current1.x * (i64)previous1.y;
-
-    previous1 = current1;
+    Trench_dig(&plan.part1, dir1, dist1);
 
-    usize col =
+    u64 col =
         UNWRAP(Span_parse_u64(UNWRAP(Span_split_on('#', line.dat)).snd, 16))
             .fst;
-    usize dist2 = col >> 4;
-    perimeter2 += dist2;
+    Trench_dig(&plan.part2, col & 0b11, col >> 4);
 
-    switch (col & 0b11) {
-    case 0:
-      current2.y -= (i64)dist2;
-      break;
-    case 1:
-      current2.x += (i64)dist2;
-      break;
-    case 2:
-      current2.y += (i64)dist2;
-      break;
-    case 3:
-      current2.x -= (i64)dist2;
-      break;
-    default:
-      panic("Unexpected\n");
+    line = SpanSplitIterator_next(&line_it);
+  }
+
+  return plan;
+}
+
+static Plan Plan_append(Plan a, Plan b) {
+  return (Plan){
+      .part1 = Trench_append(a.part1, b.part1),
+      .part2 = Trench_append(a.part2, b.part2),
+  };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Parallel
+
+#define MAX_THREADS 64
+
+typedef struct {
+  Span lines;
+  Plan plan;
+} Chunk;
+
+static void Chunk_dig(void *arg) {
+  Chunk *chunk = (Chunk *)arg;
+  Trace_begin("dig");
+  chunk->plan = Plan_dig(chunk->lines);
+  Trace_end();
+}
+
+// Each thread digs a chunk of lines from the origin, the chunks are then
+// moved into place by appending them in order
+static Plan Plan_dig_parallel(Span input, usize threads) {
+  assert(threads > 0 && threads <= MAX_THREADS);
+
+  Chunk chunks[MAX_THREADS];
+  Thread handles[MAX_THREADS];
+
+  // Split after newlines, with fewer lines than threads some chunks are empty
+  usize start = 0;
+  for (usize i = 0; i < threads; i++) {
+    usize end = input.len * (i + 1) / threads;
+    end = end < start ? start : end;
+    while (end > 0 && end < input.len && input.dat[end - 1] != '\n') {
+      end++;
     }
 
-    total2 +=
-        (i64)current2.y * (i64)previous2.x - (i64)current2.x * (i64)previous2.y;
+    chunks[i].lines = Span_slice(input, start, end);
+    start = end;
+  }
 
-    previous2 = current2;
+  for (usize i = 1; i < threads; i++) {
+    Thread_spawn(&handles[i], Chunk_dig, &chunks[i]);
+  }
+  Chunk_dig(&chunks[0]);
 
-    line = SpanSplitIterator_next(&line_it);
+  Plan plan = chunks[0].plan;
+  for (usize i = 1; i < threads; i++) {
+    Thread_join(&handles[i]);
+    plan = Plan_append(plan, chunks[i].plan);
   }
 
-  // shoelace algorithm
-  usize area1 = (usize)ABS_DIFF(i64, total1, 0) / 2;
-  usize area2 = (usize)ABS_DIFF(i64, total2, 0) / 2;
+  return plan;
+}
 
-  // pick's theorem
-  usize part1 = area1 + (perimeter1 / 2) + 1;
-  usize part2 = area2 + (perimeter2 / 2) + 1;
+static void solve(Span input) {
+  usize threads = cpu_count();
+  threads = threads > MAX_THREADS ? MAX_THREADS : threads;
+
+  // Perf counters only cover the calling thread, the trace shows the diggers
+  phase("solve");
+  Plan plan = Plan_dig_parallel(input, threads);
+  phase(NULL);
 
-  printf2("%u | %u\n", part1, part2);
+  putu128(Trench_lagoon(plan.part1));
+  putstr(" | ");
+  putu128(Trench_lagoon(plan.part2));
+  putstr("\n");
+}
+
+static bool Trench_eq(Trench a, Trench b) {
+  return a.end.x == b.end.x && a.end.y == b.end.y &&
+         a.perimeter == b.perimeter && a.total == b.total;
+}
+
+// A long generated plan, with distances up to 2^20 in both encodings, so that
+// the shoelace sum no longer fits in an i64
+static void bench(void) {
+  u64 state = RAND_SEED;
+  usize lines = 10 * 1000 * 1000;
+
+  // "R 1048575 (#fffff0)\n" is 20 bytes
+  u8 *text = (u8 *)calloc(lines * 20, sizeof(u8));
+  usize len = 0;
+
+  // Mostly right and down, so the trench wanders far from the origin
+  static const char dirs[] = "RDLURD";
+  for (usize i = 0; i < lines; i++) {
+    text[len++] = (u8)dirs[rand_next(&state) % 6];
+    text[len++] = ' ';
+    len += fmt_u64(&text[len], 8, rand_next(&state) % (1 << 20), 10);
+    text[len++] = ' ';
+    text[len++] = '(';
+    text[len++] = '#';
+
+    u64 col = ((rand_next(&state) % (1 << 20)) << 4) | (rand_next(&state) % 4);
+    // Leading zeros, the colours are always 6 digits
+    for (usize shift = 24; shift > 0; shift -= 4) {
+      text[len++] = to_digit((col >> (shift - 4)) & 0xf, 16) | 0x20;
+    }
+
+    text[len++] = ')';
+    text[len++] = '\n';
+  }
+
+  Span input = {.dat = text, .len = len};
+
+  u64 sequential_start = time_ns();
+  Plan sequential = Plan_dig(input);
+  u64 sequential_time = time_ns() - sequential_start;
+
+  printf2("%u lines: sequential %uus\n", lines, sequential_time / 1000);
+
+  usize counts[] = {2, 4, cpu_count()};
+  for (usize i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    usize threads = counts[i] > MAX_THREADS ? MAX_THREADS : counts[i];
+
+    u64 parallel_start = time_ns();
+    Plan parallel = Plan_dig_parallel(input, threads);
+    u64 parallel_time = time_ns() - parallel_start;
+
+    assert(Trench_eq(sequential.part1, parallel.part1));
+    assert(Trench_eq(sequential.part2, parallel.part2));
+    printf2("%u threads: %uus\n", threads, parallel_time / 1000);
+  }
+
+  putu128(Trench_lagoon(sequential.part1));
+  putstr(" | ");
+  putu128(Trench_lagoon(sequential.part2));
+  putstr("\n");
+
+  // More threads than lines, the first chunks are empty
+  Span line = Span_from_str("R 6 (#70c710)\n");
+  Plan one = Plan_dig_parallel(line, MAX_THREADS);
+  assert(Trench_eq(Plan_dig(line).part2, one.part2));
 }
 
 int main(void) {
@@ -111,5 +270,9 @@ int main(void) {
   Span input = Span_from_file("inputs/day18.txt");
   solve(input);
 
+  if (has_arg("--bench")) {
+    bench();
+  }
+
   return 0;
 }
@@ -1,14 +1,25 @@
 #include "baz.h"
 
+// Workflow names and rating attributes are interned to small ids when parsed,
+// so the engines below work over any number of workflows and up to MAX_DIMS
+// attributes
+#define MAX_DIMS 8
+#define MAX_WORKFLOWS (16 * 1024)
+#define MAX_RULES (8 * MAX_WORKFLOWS)
+#define MIN_RATING 1
+#define MAX_RATING 4000
+
+typedef u32 WorkflowId;
+
 typedef struct {
-  u8 field;
+  u8 dim;
   bool gt;
   u16 amount;
 } Cond;
 
 typedef struct {
   enum { GoToWorkflow, Accepted, Rejected } tag;
-  Span workflow;
+  WorkflowId workflow;
 } Outcome;
 
 typedef struct {
@@ -17,17 +28,77 @@ typedef struct {
   Outcome outcome;
 } Rule;
 
-static Cond Cond_parse(Span chunk) {
-  assert(chunk.len > 2);
+// Rules of a workflow are a range of Workflows.rules
+typedef struct {
+  u32 first;
+  u32 len;
+  bool defined;
+} Workflow;
+
+define_array(WorkflowList, Workflow, MAX_WORKFLOWS);
+define_array(RuleList, Rule, MAX_RULES);
+define_array(Dims, Span, MAX_DIMS);
+define_hash_map(WorkflowIds, Span, WorkflowId, (2 * MAX_WORKFLOWS), Span_hash,
+                Span_eq);
+
+typedef struct {
+  WorkflowIds *ids;
+  WorkflowList *workflows;
+  RuleList *rules;
+  // Attribute names, in order of first appearance
+  Dims dims;
+  WorkflowId start;
+} Workflows;
+
+static WorkflowId Workflows_id(Workflows *workflows, Span name) {
+  usize next = workflows->workflows->len;
+  WorkflowId *id =
+      WorkflowIds_insert_modify(workflows->ids, name, (WorkflowId)next);
+
+  if (*id == next) {
+    WorkflowList_push(workflows->workflows, (Workflow){0});
+  }
+
+  return *id;
+}
+
+static u8 Workflows_dim(Workflows *workflows, Span name) {
+  DimsLookup dim = Dims_linear_lookup(&workflows->dims, &name, Span_eq);
+  if (dim.valid) {
+    return (u8)dim.dat;
+  }
+
+  Dims_push(&workflows->dims, name);
+  return (u8)(workflows->dims.len - 1);
+}
+
+static Workflows Workflows_new(void) {
+  Workflows workflows = {
+      .ids = (WorkflowIds *)calloc(1, sizeof(WorkflowIds)),
+      .workflows = (WorkflowList *)calloc(1, sizeof(WorkflowList)),
+      .rules = (RuleList *)calloc(1, sizeof(RuleList)),
+  };
+  workflows.start = Workflows_id(&workflows, Span_from_str("in"));
+  return workflows;
+}
+
+static Cond Cond_parse(Workflows *workflows, Span chunk) {
+  usize op = 0;
+  while (op < chunk.len && chunk.dat[op] != '<' && chunk.dat[op] != '>') {
+    op++;
+  }
+  assert(op > 0 && op + 1 < chunk.len);
+
   return (Cond){
-      .field = chunk.dat[0],
-      .gt = (chunk.dat[1] == '>'),
-      .amount =
-          (u16)UNWRAP(Span_parse_u64(Span_slice(chunk, 2, chunk.len), 10)).fst,
+      .dim = Workflows_dim(workflows, Span_slice(chunk, 0, op)),
+      .gt = (chunk.dat[op] == '>'),
+      .amount = (u16)UNWRAP(
+                    Span_parse_u64(Span_slice(chunk, op + 1, chunk.len), 10))
+                    .fst,
   };
 }
 
-static Outcome Outcome_parse(Span chunk) {
+static Outcome Outcome_parse(Workflows *workflows, Span chunk) {
   if (Span_match(&chunk, "A")) {
     return (Outcome){
         .tag = Accepted,
@@ -39,59 +110,83 @@ static Outcome Outcome_parse(Span chunk) {
   } else {
     return (Outcome){
         .tag = GoToWorkflow,
-        .workflow = chunk,
+        .workflow = Workflows_id(workflows, chunk),
     };
   }
 }
 
-static Rule Rule_parse(Span chunk) {
+static Rule Rule_parse(Workflows *workflows, Span chunk) {
   SpanSplitOn res = Span_split_on(':', chunk);
 
   if (res.valid) {
-    Cond cond = Cond_parse(res.dat.fst);
+    Cond cond = Cond_parse(workflows, res.dat.fst);
     return (Rule){
         .with_condition = true,
         .cond = cond,
-        .outcome = Outcome_parse(res.dat.snd),
+        .outcome = Outcome_parse(workflows, res.dat.snd),
     };
   } else {
     return (Rule){
         .with_condition = false,
-        .outcome = Outcome_parse(chunk),
+        .outcome = Outcome_parse(workflows, chunk),
     };
   }
 }
 
-define_array(Rules, Rule, 8);
-define_hash_map(Workflows, Span, Rules, 1024, Span_hash, Span_eq);
+// Parse "name{rules}"
+static void Workflows_parse(Workflows *workflows, Span line) {
+  SpanSplitOn res = Span_split_on('{', line);
+  assert(res.valid);
 
-typedef struct {
-  u16 x;
-  u16 m;
-  u16 a;
-  u16 s;
-} Rating;
+  Span rules = res.dat.snd;
+  assert(rules.dat[rules.len - 1] == '}');
+  SpanSplitIterator chunk_it = {
+      .sep = ',',
+      .rest = Span_slice(rules, 0, rules.len - 1),
+  };
 
-static bool Cond_match(Cond cond, Rating rating) {
-  u16 field;
+  WorkflowId id = Workflows_id(workflows, res.dat.fst);
+  u32 first = (u32)workflows->rules->len;
 
-  switch (cond.field) {
-  case 'x':
-    field = rating.x;
-    break;
-  case 'm':
-    field = rating.m;
-    break;
-  case 'a':
-    field = rating.a;
-    break;
-  case 's':
-    field = rating.s;
-    break;
-  default:
-    panic("Unexpected!\n");
+  SpanSplitIteratorNext chunk = SpanSplitIterator_next(&chunk_it);
+  while (chunk.valid) {
+    RuleList_push(workflows->rules, Rule_parse(workflows, chunk.dat));
+    chunk = SpanSplitIterator_next(&chunk_it);
   }
 
+  Workflow *workflow = &workflows->workflows->dat[id];
+  assert(!workflow->defined);
+  *workflow = (Workflow){
+      .first = first,
+      .len = (u32)workflows->rules->len - first,
+      .defined = true,
+  };
+
+  // Every workflow must end on an unconditional rule
+  assert(workflow->len > 0);
+  assert(!workflows->rules->dat[workflows->rules->len - 1].with_condition);
+}
+
+static void Workflows_check(const Workflows *workflows) {
+  for (usize i = 0; i < workflows->workflows->len; i++) {
+    assert_msg(workflows->workflows->dat[i].defined, "undefined workflow\n");
+  }
+}
+
+static const Rule *Workflows_rules(const Workflows *workflows, WorkflowId id) {
+  return &workflows->rules->dat[workflows->workflows->dat[id].first];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Ratings
+
+typedef struct {
+  u16 dat[MAX_DIMS];
+} Rating;
+
+static bool Cond_match(Cond cond, const Rating *rating) {
+  u16 field = rating->dat[cond.dim];
+
   if (cond.gt) {
     return field > cond.amount;
   } else {
@@ -99,9 +194,13 @@ static bool Cond_match(Cond cond, Rating rating) {
   }
 }
 
-static Outcome Rules_outcome(const Rules *rules, Rating rating) {
-  for (usize i = 0; i < rules->len; i++) {
-    Rule rule = rules->dat[i];
+static Outcome Workflows_outcome(const Workflows *workflows, WorkflowId id,
+                                 const Rating *rating) {
+  const Rule *rules = Workflows_rules(workflows, id);
+  usize len = workflows->workflows->dat[id].len;
+
+  for (usize i = 0; i < len; i++) {
+    Rule rule = rules[i];
 
     if (rule.with_condition) {
       if (Cond_match(rule.cond, rating)) {
@@ -115,7 +214,8 @@ static Outcome Rules_outcome(const Rules *rules, Rating rating) {
   panic("Unexpected!\n");
 }
 
-static Rating Rating_parse(Span line) {
+// Parse "{x=787,m=2655,...}", attributes can come in any order
+static Rating Rating_parse(Workflows *workflows, Span line) {
   assert(line.len > 1);
 
   SpanSplitIterator field_it = {
@@ -123,25 +223,27 @@ static Rating Rating_parse(Span line) {
       .rest = Span_slice(line, 1, line.len - 1),
   };
 
-  Span x = UNWRAP(SpanSplitIterator_next(&field_it));
-  Span m = UNWRAP(SpanSplitIterator_next(&field_it));
-  Span a = UNWRAP(SpanSplitIterator_next(&field_it));
-  Span s = UNWRAP(SpanSplitIterator_next(&field_it));
+  Rating rating = {0};
 
-  return (Rating){
-      .x = (u16)UNWRAP(Span_parse_u64(Span_slice(x, 2, x.len), 10)).fst,
-      .m = (u16)UNWRAP(Span_parse_u64(Span_slice(m, 2, m.len), 10)).fst,
-      .a = (u16)UNWRAP(Span_parse_u64(Span_slice(a, 2, a.len), 10)).fst,
-      .s = (u16)UNWRAP(Span_parse_u64(Span_slice(s, 2, s.len), 10)).fst,
-  };
+  SpanSplitIteratorNext field = SpanSplitIterator_next(&field_it);
+  while (field.valid) {
+    SpanSplitOn res = Span_split_on('=', field.dat);
+    assert(res.valid);
+
+    u8 dim = Workflows_dim(workflows, res.dat.fst);
+    rating.dat[dim] = (u16)UNWRAP(Span_parse_u64(res.dat.snd, 10)).fst;
+
+    field = SpanSplitIterator_next(&field_it);
+  }
+
+  return rating;
 }
 
-static bool Rating_accepted(Workflows *workflows, Rating rating) {
-  Span current = Span_from_str("in");
+static bool Rating_accepted(const Workflows *workflows, const Rating *rating) {
+  WorkflowId current = workflows->start;
 
   while (true) {
-    const Rules *rules = UNWRAP(Workflows_lookup(workflows, &current));
-    Outcome outcome = Rules_outcome(rules, rating);
+    Outcome outcome = Workflows_outcome(workflows, current, rating);
 
     switch (outcome.tag) {
     case GoToWorkflow:
@@ -155,165 +257,751 @@ static bool Rating_accepted(Workflows *workflows, Rating rating) {
   }
 }
 
-static Rules Rules_parse(Span line) {
-  assert(line.dat[line.len - 1] == '}');
-  SpanSplitIterator chunk_it = {
-      .sep = ',',
-      .rest = Span_slice(line, 0, line.len - 1),
-  };
+////////////////////////////////////////////////////////////////////////////////
+// Boxes
 
-  Rules rules = {0};
+// Inclusive [min, max] per attribute
+typedef struct {
+  u16 min[MAX_DIMS];
+  u16 max[MAX_DIMS];
+} Box;
 
-  SpanSplitIteratorNext chunk = SpanSplitIterator_next(&chunk_it);
-  while (chunk.valid) {
-    Rules_push(&rules, Rule_parse(chunk.dat));
-    chunk = SpanSplitIterator_next(&chunk_it);
+static Box Box_full(usize dims) {
+  Box box = {0};
+  for (usize d = 0; d < dims; d++) {
+    box.min[d] = MIN_RATING;
+    box.max[d] = MAX_RATING;
+  }
+  return box;
+}
+
+static bool Box_empty(const Box *box, usize dims) {
+  for (usize d = 0; d < dims; d++) {
+    if (box->min[d] > box->max[d]) {
+      return true;
+    }
   }
+  return false;
+}
 
-  return rules;
+// 4000^8 still fits
+static u128 Box_volume(const Box *box, usize dims) {
+  u128 volume = 1;
+  for (usize d = 0; d < dims; d++) {
+    if (box->min[d] > box->max[d]) {
+      return 0;
+    }
+    volume *= (u128)(u16)(1 + box->max[d] - box->min[d]);
+  }
+  return volume;
 }
 
+// Bounds are computed in i32 and clamped to one past the ratings on either
+// side, which keeps an empty range empty (min > max) once narrowed to u16
+static inline u16 Bound_clamp(i32 x) {
+  i32 lo = MIN_RATING - 1;
+  i32 hi = MAX_RATING + 1;
+  return (u16)(x < lo ? lo : x > hi ? hi : x);
+}
+
+static inline u16 Bound_max(u16 a, i32 b) {
+  return Bound_clamp((i32)a > b ? (i32)a : b);
+}
+
+static inline u16 Bound_min(u16 a, i32 b) {
+  return Bound_clamp((i32)a < b ? (i32)a : b);
+}
+
+// Split off the part of box matching cond, box keeps the rest
+static Box Box_split(Box *box, Cond cond) {
+  Box match = *box;
+  u8 d = cond.dim;
+  i32 amount = (i32)cond.amount;
+
+  if (cond.gt) {
+    match.min[d] = Bound_max(match.min[d], amount + 1);
+    box->max[d] = Bound_min(box->max[d], amount);
+  } else {
+    match.max[d] = Bound_min(match.max[d], amount - 1);
+    box->min[d] = Bound_max(box->min[d], amount);
+  }
+
+  return match;
+}
+
+// Splits at and past the rating bounds must not wrap when narrowed to u16
+static void check_box_edges(void) {
+  static const u16 amounts[] = {0, MIN_RATING, MAX_RATING, UINT16_MAX};
+
+  for (usize i = 0; i < sizeof(amounts) / sizeof(amounts[0]); i++) {
+    for (usize gt = 0; gt < 2; gt++) {
+      Cond cond = {.dim = 0, .gt = gt == 1, .amount = amounts[i]};
+      Box rest = Box_full(1);
+      Box match = Box_split(&rest, cond);
+
+      u128 expected = 0;
+      for (u16 x = MIN_RATING; x <= MAX_RATING; x++) {
+        expected += cond.gt ? x > cond.amount : x < cond.amount;
+      }
+      assert(Box_volume(&match, 1) == expected);
+      assert(Box_volume(&rest, 1) == MAX_RATING - expected);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Counting by search
+
 typedef struct {
-  Span current;
-  Rating min;
-  Rating max;
+  WorkflowId current;
+  Box box;
 } SearchState;
 
-define_array(Search, SearchState, 256);
+define_array(Search, SearchState, (64 * 1024));
 
-#define MAX(A, B) (A > B ? A : B)
-#define MIN(A, B) (A < B ? A : B)
+// Split the box down through the workflows, as many times as a workflow is
+// reached. This also works with cycles, as long as boxes shrink around them
+static u128 Workflows_count_search(const Workflows *workflows) {
+  usize dims = workflows->dims.len;
+  u128 count = 0;
 
-static usize Workflows_count_distinct(Workflows *workflows) {
-  usize count = 0;
-  Search search = {0};
-  Search_push(&search, (SearchState){
-                           .current = Span_from_str("in"),
-                           .min = {.x = 1, .m = 1, .a = 1, .s = 1},
-                           .max = {.x = 4000, .m = 4000, .a = 4000, .s = 4000},
-                       });
+  Search *search = (Search *)calloc(1, sizeof(Search));
+  Search_push(search, (SearchState){
+                          .current = workflows->start,
+                          .box = Box_full(dims),
+                      });
 
-  SearchPop next = Search_pop(&search);
+  SearchPop next = Search_pop(search);
   while (next.valid) {
-    const Rules *rules = UNWRAP(Workflows_lookup(workflows, &next.dat.current));
-
-    for (usize i = 0; i < rules->len; i++) {
-      Rule rule = rules->dat[i];
-
-      SearchState state = next.dat;
-      if (rule.with_condition) {
-        switch (rule.cond.field) {
-        case 'x':
-          if (rule.cond.gt) {
-            state.min.x = (u16)MAX(state.min.x, rule.cond.amount + 1);
-            next.dat.max.x = (u16)MIN(next.dat.max.x, rule.cond.amount);
-          } else {
-            state.max.x = (u16)MIN(state.max.x, rule.cond.amount - 1);
-            next.dat.min.x = (u16)MAX(next.dat.min.x, rule.cond.amount);
-          }
-          break;
-        case 'm':
-          if (rule.cond.gt) {
-            state.min.m = (u16)MAX(state.min.m, rule.cond.amount + 1);
-            next.dat.max.m = (u16)MIN(next.dat.max.m, rule.cond.amount);
-          } else {
-            state.max.m = (u16)MIN(state.max.m, rule.cond.amount - 1);
-            next.dat.min.m = (u16)MAX(next.dat.min.m, rule.cond.amount);
-          }
-          break;
-        case 'a':
-          if (rule.cond.gt) {
-            state.min.a = (u16)MAX(state.min.a, rule.cond.amount + 1);
-            next.dat.max.a = (u16)MIN(next.dat.max.a, rule.cond.amount);
-          } else {
-            state.max.a = (u16)MIN(state.max.a, rule.cond.amount - 1);
-            next.dat.min.a = (u16)MAX(next.dat.min.a, rule.cond.amount);
-          }
-          break;
-        case 's':
-          if (rule.cond.gt) {
-            state.min.s = (u16)MAX(state.min.s, rule.cond.amount + 1);
-            next.dat.max.s = (u16)MIN(next.dat.max.s, rule.cond.amount);
-          } else {
-            state.max.s = (u16)MIN(state.max.s, rule.cond.amount - 1);
-            next.dat.min.s = (u16)MAX(next.dat.min.s, rule.cond.amount);
-          }
-          break;
-        default:
-          panic("Unexpected\n");
-        }
+    const Rule *rules = Workflows_rules(workflows, next.dat.current);
+    usize len = workflows->workflows->dat[next.dat.current].len;
+    Box rest = next.dat.box;
+
+    for (usize i = 0; i < len && !Box_empty(&rest, dims); i++) {
+      Rule rule = rules[i];
+      Box match = rule.with_condition ? Box_split(&rest, rule.cond) : rest;
+
+      if (Box_empty(&match, dims)) {
+        continue;
       }
 
       switch (rule.outcome.tag) {
       case GoToWorkflow:
-        state.current = rule.outcome.workflow;
-        Search_push(&search, state);
+        Search_push(search, (SearchState){
+                                .current = rule.outcome.workflow,
+                                .box = match,
+                            });
         break;
       case Rejected:
         break;
-      case Accepted: {
-        usize dx =
-            (usize)(state.max.x >= state.min.x ? 1 + state.max.x - state.min.x
-                                               : 0);
-        usize dm =
-            (usize)(state.max.m >= state.min.m ? 1 + state.max.m - state.min.m
-                                               : 0);
-        usize da =
-            (usize)(state.max.a >= state.min.a ? 1 + state.max.a - state.min.a
-                                               : 0);
-        usize ds =
-            (usize)(state.max.s >= state.min.s ? 1 + state.max.s - state.min.s
-                                               : 0);
-
-        count += dx * dm * da * ds;
+      case Accepted:
+        count += Box_volume(&match, dims);
         break;
       }
+    }
+
+    next = Search_pop(search);
+  }
+
+  free(search);
+  return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Counting by memoised workflows
+
+typedef struct {
+  WorkflowId id;
+  u32 rule;
+} Visit;
+
+define_array(Visits, Visit, MAX_WORKFLOWS);
+define_array(WorkflowIdList, WorkflowId, MAX_WORKFLOWS);
+
+typedef struct {
+  bool dag;
+  bool shared;
+  // Workflows reachable from "in", children before parents
+  WorkflowIdList *postorder;
+} Shape;
+
+// Depth first search from "in", looking for cycles and for workflows reached
+// from more than one rule
+static Shape Workflows_shape(const Workflows *workflows) {
+  enum { Unseen = 0, Open, Done };
+  u8 *state = (u8 *)calloc(workflows->workflows->len, sizeof(u8));
+  Visits *visits = (Visits *)calloc(1, sizeof(Visits));
+
+  Shape shape = {
+      .dag = true,
+      .postorder = (WorkflowIdList *)calloc(1, sizeof(WorkflowIdList)),
+  };
+
+  Visits_push(visits, (Visit){.id = workflows->start});
+  state[workflows->start] = Open;
+
+  while (shape.dag && visits->len > 0) {
+    Visit *visit = &visits->dat[visits->len - 1];
+    const Workflow *workflow = &workflows->workflows->dat[visit->id];
+
+    if (visit->rule == workflow->len) {
+      state[visit->id] = Done;
+      WorkflowIdList_push(shape.postorder, visit->id);
+      visits->len--;
+      continue;
+    }
+
+    const Rule *rules = Workflows_rules(workflows, visit->id);
+    Outcome outcome = rules[visit->rule++].outcome;
+
+    if (outcome.tag != GoToWorkflow) {
+      continue;
+    }
+
+    switch (state[outcome.workflow]) {
+    case Unseen:
+      state[outcome.workflow] = Open;
+      Visits_push(visits, (Visit){.id = outcome.workflow});
+      break;
+    case Open:
+      shape.dag = false;
+      break;
+    case Done:
+      shape.shared = true;
+      break;
+    }
+  }
+
+  free(visits);
+  free(state);
+  return shape;
+}
+
+// Attributes tested anywhere below each workflow, as a bit mask
+_Static_assert(MAX_DIMS <= 8, "relevant dims should fit in a u8");
+static u8 *Workflows_relevant_dims(const Workflows *workflows,
+                                   const WorkflowIdList *postorder) {
+  u8 *relevant = (u8 *)calloc(workflows->workflows->len, sizeof(u8));
+
+  for (usize i = 0; i < postorder->len; i++) {
+    WorkflowId id = postorder->dat[i];
+    const Rule *rules = Workflows_rules(workflows, id);
+
+    for (usize r = 0; r < workflows->workflows->dat[id].len; r++) {
+      if (rules[r].with_condition) {
+        relevant[id] |= (u8)(1 << rules[r].cond.dim);
+      }
+      if (rules[r].outcome.tag == GoToWorkflow) {
+        relevant[id] |= relevant[rules[r].outcome.workflow];
       }
     }
+  }
+
+  return relevant;
+}
+
+typedef struct {
+  WorkflowId id;
+  Box box;
+} VolumeKey;
+
+static Hash VolumeKey_hash(const VolumeKey *key) {
+  FxHasher hasher = {0};
+  FxHasher_add(&hasher, key->id);
+  for (usize d = 0; d < MAX_DIMS; d++) {
+    FxHasher_add(&hasher, (usize)key->box.min[d] << 16 | key->box.max[d]);
+  }
+  return hasher;
+}
+
+static bool VolumeKey_eq(const VolumeKey *a, const VolumeKey *b) {
+  return a->id == b->id && memcmp(&a->box, &b->box, sizeof(Box)) == 0;
+}
+
+define_hash_map(VolumeCache, VolumeKey, u128, (64 * 1024), VolumeKey_hash,
+                VolumeKey_eq);
+
+typedef struct {
+  const Workflows *workflows;
+  const u8 *relevant;
+  VolumeCache *cache;
+} Memo;
+
+// Accepted volume of a box entering a workflow. The box is first projected on
+// the attributes tested below the workflow (the others are collapsed to a
+// single value and multiplied back in), so every path reaching a shared
+// sub-workflow with the same relevant ranges shares one evaluation
+static u128 Memo_volume(Memo *memo, WorkflowId id, Box box) {
+  usize dims = memo->workflows->dims.len;
+  u128 scale = 1;
+
+  for (usize d = 0; d < dims; d++) {
+    if (!((memo->relevant[id] >> d) & 1)) {
+      scale *= (u128)(u16)(1 + box.max[d] - box.min[d]);
+      box.min[d] = MIN_RATING;
+      box.max[d] = MIN_RATING;
+    }
+  }
+
+  VolumeKey key = {.id = id, .box = box};
+  VolumeCacheLookup hit = VolumeCache_lookup(memo->cache, &key);
+  if (hit.valid) {
+    return *hit.dat * scale;
+  }
+
+  const Rule *rules = Workflows_rules(memo->workflows, id);
+  usize len = memo->workflows->workflows->dat[id].len;
+  u128 volume = 0;
+
+  for (usize i = 0; i < len && !Box_empty(&box, dims); i++) {
+    Rule rule = rules[i];
+    Box match = rule.with_condition ? Box_split(&box, rule.cond) : box;
+
+    if (Box_empty(&match, dims)) {
+      continue;
+    }
 
-    next = Search_pop(&search);
+    switch (rule.outcome.tag) {
+    case GoToWorkflow:
+      volume += Memo_volume(memo, rule.outcome.workflow, match);
+      break;
+    case Rejected:
+      break;
+    case Accepted:
+      volume += Box_volume(&match, dims);
+      break;
+    }
   }
 
+  // Leave room for the open addressing, past that just stop caching
+  if (memo->cache->count < VolumeCache_capacity / 2) {
+    VolumeCache_insert(memo->cache, key, volume);
+  }
+
+  return volume * scale;
+}
+
+// Recursive, so only for a DAG
+static u128 Workflows_count_memo(const Workflows *workflows,
+                                 const WorkflowIdList *postorder) {
+  Memo memo = {
+      .workflows = workflows,
+      .relevant = Workflows_relevant_dims(workflows, postorder),
+      .cache = (VolumeCache *)calloc(1, sizeof(VolumeCache)),
+  };
+
+  u128 count =
+      Memo_volume(&memo, workflows->start, Box_full(workflows->dims.len));
+
+  free(memo.cache);
+  free((u8 *)memo.relevant);
   return count;
 }
 
+// Memoising only pays off when sub-workflows are shared, a tree (such as the
+// puzzle input) is searched directly. So are cycles
+static u128 Workflows_count_distinct(const Workflows *workflows) {
+  Shape shape = Workflows_shape(workflows);
+
+  if (shape.dag && shape.shared) {
+    return Workflows_count_memo(workflows, shape.postorder);
+  } else {
+    return Workflows_count_search(workflows);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// JIT
+
+// Workflows compiled to x86-64. The rating fields are loaded once into
+// (caller saved) registers, each rule is a compare and a conditional jump, and
+// moving to another workflow is a direct jump to its code
+typedef bool (*Compiled)(const Rating *rating);
+
+// Register of each attribute, rdi (holding the rating) is overwritten last
+static const u8 jit_registers[MAX_DIMS] = {
+    6 /* esi */, 2 /* edx */, 1 /* ecx */, 8,  9, 10, 11, 7 /* edi */,
+};
+
+#define JIT_ACCEPT UINT32_MAX
+#define JIT_REJECT (UINT32_MAX - 1)
+
+// A rel32 to patch once every workflow has been placed
+typedef struct {
+  u32 at;
+  u32 target;
+} Fixup;
+
+typedef struct {
+  u8 *code;
+  usize len;
+  usize capacity;
+  Fixup *fixups;
+  usize fixups_len;
+} Jit;
+
+static void Jit_u8(Jit *jit, u8 x) {
+  assert(jit->len < jit->capacity);
+  jit->code[jit->len++] = x;
+}
+
+static void Jit_u32(Jit *jit, u32 x) {
+  for (usize i = 0; i < 4; i++) {
+    Jit_u8(jit, (u8)(x >> (8 * i)));
+  }
+}
+
+static void Jit_rel32(Jit *jit, Outcome outcome) {
+  u32 target = 0;
+  switch (outcome.tag) {
+  case GoToWorkflow:
+    target = outcome.workflow;
+    break;
+  case Accepted:
+    target = JIT_ACCEPT;
+    break;
+  case Rejected:
+    target = JIT_REJECT;
+    break;
+  }
+
+  jit->fixups[jit->fixups_len++] = (Fixup){
+      .at = (u32)jit->len,
+      .target = target,
+  };
+  Jit_u32(jit, 0);
+}
+
+// movzx reg32, word [rdi + 2 * dim]
+static void Jit_load(Jit *jit, u8 reg, u8 dim) {
+  if (reg >= 8) {
+    Jit_u8(jit, 0x44);
+  }
+  Jit_u8(jit, 0x0f);
+  Jit_u8(jit, 0xb7);
+  Jit_u8(jit, (u8)(0x47 | (reg & 7) << 3));
+  Jit_u8(jit, (u8)(2 * dim));
+}
+
+// cmp reg32, imm32
+static void Jit_cmp(Jit *jit, u8 reg, u32 imm) {
+  if (reg >= 8) {
+    Jit_u8(jit, 0x41);
+  }
+  Jit_u8(jit, 0x81);
+  Jit_u8(jit, (u8)(0xf8 | (reg & 7)));
+  Jit_u32(jit, imm);
+}
+
+// jg/jl rel32, or jmp rel32 for an unconditional rule
+static void Jit_rule(Jit *jit, Rule rule) {
+  if (rule.with_condition) {
+    Jit_cmp(jit, jit_registers[rule.cond.dim], rule.cond.amount);
+    Jit_u8(jit, 0x0f);
+    Jit_u8(jit, rule.cond.gt ? 0x8f : 0x8c);
+  } else {
+    Jit_u8(jit, 0xe9);
+  }
+
+  Jit_rel32(jit, rule.outcome);
+}
+
+static Compiled Workflows_compile(const Workflows *workflows) {
+  usize count = workflows->workflows->len;
+  usize rules = workflows->rules->len;
+
+  // At most 13 bytes per rule (cmp with REX + jcc)
+  usize capacity = 64 + 16 * rules;
+  Jit jit = {
+      .code = (u8 *)calloc(capacity, sizeof(u8)),
+      .capacity = capacity,
+      .fixups = (Fixup *)calloc(rules + 1, sizeof(Fixup)),
+  };
+  u32 *labels = (u32 *)calloc(count, sizeof(u32));
+
+  for (u8 d = 0; d < workflows->dims.len; d++) {
+    Jit_load(&jit, jit_registers[d], d);
+  }
+
+  Jit_u8(&jit, 0xe9);
+  Jit_rel32(&jit, (Outcome){.tag = GoToWorkflow, .workflow = workflows->start});
+
+  for (usize id = 0; id < count; id++) {
+    labels[id] = (u32)jit.len;
+
+    const Rule *rule = Workflows_rules(workflows, (WorkflowId)id);
+    for (usize i = 0; i < workflows->workflows->dat[id].len; i++) {
+      Jit_rule(&jit, rule[i]);
+    }
+  }
+
+  // mov eax, 1; ret
+  u32 accept = (u32)jit.len;
+  Jit_u8(&jit, 0xb8);
+  Jit_u32(&jit, 1);
+  Jit_u8(&jit, 0xc3);
+
+  // xor eax, eax; ret
+  u32 reject = (u32)jit.len;
+  Jit_u8(&jit, 0x31);
+  Jit_u8(&jit, 0xc0);
+  Jit_u8(&jit, 0xc3);
+
+  for (usize i = 0; i < jit.fixups_len; i++) {
+    Fixup fixup = jit.fixups[i];
+    u32 target = fixup.target == JIT_ACCEPT   ? accept
+                 : fixup.target == JIT_REJECT ? reject
+                                              : labels[fixup.target];
+
+    // Relative to the end of the instruction
+    u32 rel = target - (fixup.at + 4);
+    memcpy(&jit.code[fixup.at], &rel, sizeof(u32));
+  }
+
+  free(labels);
+  free(jit.fixups);
+
+  isize ret = sys_mprotect(jit.code, jit.capacity, PROT_READ | PROT_EXEC);
+  assert(ret == 0);
+
+  return (Compiled)(void *)jit.code;
+}
+
 static void solve(Span input) {
   SpanSplitIterator line_it = Span_split_lines(input);
 
-  Workflows workflows = {0};
+  Workflows workflows = Workflows_new();
   bool reading_ratings = false;
+  Compiled compiled = NULL;
   usize part1 = 0;
 
+  // Ratings are checked as they are parsed, that is part 1
+  phase("parse");
+
   SpanSplitIteratorNext line = SpanSplitIterator_next(&line_it);
   while (line.valid) {
     if (line.dat.len == 0) {
+      Workflows_check(&workflows);
+      if (has_arg("--jit")) {
+        compiled = Workflows_compile(&workflows);
+      }
       reading_ratings = true;
+      phase("part1");
       line = SpanSplitIterator_next(&line_it);
       continue;
     }
 
     if (reading_ratings) {
-      Rating rating = Rating_parse(line.dat);
+      Rating rating = Rating_parse(&workflows, line.dat);
+      bool accepted = compiled ? compiled(&rating)
+                               : Rating_accepted(&workflows, &rating);
 
-      if (Rating_accepted(&workflows, rating)) {
-        part1 += (usize)rating.x;
-        part1 += (usize)rating.m;
-        part1 += (usize)rating.a;
-        part1 += (usize)rating.s;
+      if (accepted) {
+        for (usize d = 0; d < workflows.dims.len; d++) {
+          part1 += (usize)rating.dat[d];
+        }
       }
     } else {
-      SpanSplitOn res = Span_split_on('{', line.dat);
-      assert(res.valid);
+      Workflows_parse(&workflows, line.dat);
+    }
+
+    line = SpanSplitIterator_next(&line_it);
+  }
+
+  phase("part2");
+  u128 part2 = Workflows_count_distinct(&workflows);
+  phase(NULL);
+
+  putu64(part1);
+  putstr(" | ");
+  putu128(part2);
+  putstr("\n");
+}
+
+typedef struct {
+  u8 *dat;
+  usize len;
+} Text;
+
+static void Text_str(Text *text, const char *str) {
+  usize len = strlen(str);
+  memcpy(&text->dat[text->len], str, len);
+  text->len += len;
+}
+
+static void Text_u64(Text *text, u64 x) {
+  text->len += fmt_u64(&text->dat[text->len], 32, x, 10);
+}
+
+// Routers are "in", "r1", "r2", ... and chains "cx0", "cx1", ..., "cm0", ...
+static void Text_workflow(Text *text, usize router, usize dim, usize link) {
+  static const char *chains[] = {"cx", "cm", "ca", "cs", "cu", "cv"};
+
+  if (dim < 6) {
+    Text_str(text, chains[dim]);
+    Text_u64(text, link);
+  } else if (router == 0) {
+    Text_str(text, "in");
+  } else {
+    Text_str(text, "r");
+    Text_u64(text, router);
+  }
+}
+
+static void Text_cond(Text *text, usize dim, u64 *state) {
+  static const char *dims[] = {"x", "m", "a", "s", "u", "v"};
+
+  Text_str(text, dims[dim]);
+  Text_str(text, rand_next(state) % 2 ? "<" : ">");
+  Text_u64(text, 2 + rand_next(state) % (MAX_RATING - 2));
+  Text_str(text, ":");
+}
+
+// A generated DAG over 6 attributes: routers test any attribute and jump to
+// the next few routers, or into one of the chains. Each chain only tests one
+// attribute, and is shared by every path reaching it
+static void bench_memo(usize routers, usize links) {
+  u64 state = RAND_SEED;
+  usize rules = 3;
+
+  Text text = {.dat = (u8 *)calloc((routers + 6 * links) * 128, sizeof(u8))};
+
+  for (usize i = 0; i < routers; i++) {
+    Text_workflow(&text, i, 6, 0);
+    Text_str(&text, "{");
+
+    for (usize r = 0; r <= rules; r++) {
+      if (r < rules) {
+        Text_cond(&text, rand_next(&state) % 6, &state);
+      }
+
+      u64 pick = rand_next(&state) % 16;
+      usize next = i + 1 + rand_next(&state) % 4;
+      if (pick == 0) {
+        Text_str(&text, "A");
+      } else if (pick == 1) {
+        Text_str(&text, "R");
+      } else if (pick == 2 || next >= routers) {
+        Text_workflow(&text, 0, rand_next(&state) % 6, 0);
+      } else {
+        Text_workflow(&text, next, 6, 0);
+      }
+
+      Text_str(&text, r < rules ? "," : "}\n");
+    }
+  }
+
+  for (usize dim = 0; dim < 6; dim++) {
+    for (usize i = 0; i < links; i++) {
+      Text_workflow(&text, 0, dim, i);
+      Text_str(&text, "{");
+
+      for (usize r = 0; r <= rules; r++) {
+        if (r < rules) {
+          Text_cond(&text, dim, &state);
+        }
+
+        u64 pick = rand_next(&state) % 32;
+        usize next = i + 1 + rand_next(&state) % 3;
+        if (pick == 0 || next >= links) {
+          Text_str(&text, "A");
+        } else if (pick == 1) {
+          Text_str(&text, "R");
+        } else {
+          Text_workflow(&text, 0, dim, next);
+        }
+
+        Text_str(&text, r < rules ? "," : "}\n");
+      }
+    }
+  }
+
+  Workflows workflows = Workflows_new();
+  SpanSplitIterator line_it =
+      Span_split_lines((Span){.dat = text.dat, .len = text.len});
+  SpanSplitIteratorNext line = SpanSplitIterator_next(&line_it);
+  while (line.valid) {
+    Workflows_parse(&workflows, line.dat);
+    line = SpanSplitIterator_next(&line_it);
+  }
+  Workflows_check(&workflows);
+
+  u64 search_start = time_ns();
+  u128 search = Workflows_count_search(&workflows);
+  u64 search_time = time_ns() - search_start;
+
+  Shape shape = Workflows_shape(&workflows);
+  assert(shape.dag && shape.shared);
 
-      Workflows_insert(&workflows, res.dat.fst, Rules_parse(res.dat.snd));
+  u64 memo_start = time_ns();
+  u128 memo = Workflows_count_memo(&workflows, shape.postorder);
+  u64 memo_time = time_ns() - memo_start;
+
+  assert(search == memo);
+
+  // Also exercises the JIT on the extended registers
+  Compiled compiled = Workflows_compile(&workflows);
+  for (usize i = 0; i < 100000; i++) {
+    Rating rating = {0};
+    for (usize d = 0; d < workflows.dims.len; d++) {
+      rating.dat[d] = (u16)(MIN_RATING + rand_next(&state) % MAX_RATING);
     }
+    assert(compiled(&rating) == Rating_accepted(&workflows, &rating));
+  }
+
+  printf3("%u workflows, %u attributes: %u accepted (low 64 bits)\n",
+          workflows.workflows->len, workflows.dims.len, (u64)memo);
+  printf2("search %uus | memo %uus\n", search_time / 1000, memo_time / 1000);
+}
 
+// Random ratings through the puzzle workflows, interpreted and compiled
+static void bench_jit(Span input) {
+  Workflows workflows = Workflows_new();
+  SpanSplitIterator line_it = Span_split_lines(input);
+  SpanSplitIteratorNext line = SpanSplitIterator_next(&line_it);
+  while (line.valid && line.dat.len > 0) {
+    Workflows_parse(&workflows, line.dat);
     line = SpanSplitIterator_next(&line_it);
   }
+  Workflows_check(&workflows);
+
+  u64 compile_start = time_ns();
+  Compiled compiled = Workflows_compile(&workflows);
+  u64 compile_time = time_ns() - compile_start;
+
+  u64 state = RAND_SEED;
+  usize len = 10 * 1000 * 1000;
+  Rating *ratings = (Rating *)calloc(len, sizeof(Rating));
+  for (usize i = 0; i < len; i++) {
+    for (usize d = 0; d < workflows.dims.len; d++) {
+      ratings[i].dat[d] =
+          (u16)(MIN_RATING + rand_next(&state) % (MAX_RATING - MIN_RATING + 1));
+    }
+  }
 
-  usize part2 = Workflows_count_distinct(&workflows);
+  for (usize i = 0; i < len / 10; i++) {
+    assert(compiled(&ratings[i]) == Rating_accepted(&workflows, &ratings[i]));
+  }
+
+  usize interpreted = 0;
+  u64 interpreted_start = time_ns();
+  for (usize i = 0; i < len; i++) {
+    interpreted += Rating_accepted(&workflows, &ratings[i]);
+  }
+  u64 interpreted_time = time_ns() - interpreted_start;
 
-  printf2("%u | %u\n", part1, part2);
+  usize jitted = 0;
+  u64 jitted_start = time_ns();
+  for (usize i = 0; i < len; i++) {
+    jitted += compiled(&ratings[i]);
+  }
+  u64 jitted_time = time_ns() - jitted_start;
+
+  assert(interpreted == jitted);
+  printf3("%u ratings, %u accepted, compiled in %uus\n", len, jitted,
+          compile_time / 1000);
+  printf2("interpreter %u ratings/s | jit %u ratings/s\n",
+          len * 1000000000 / interpreted_time, len * 1000000000 / jitted_time);
 }
 
 int main(void) {
@@ -335,9 +1023,15 @@ int main(void) {
                                "{x=2461,m=1339,a=466,s=291}\n"
                                "{x=2127,m=1623,a=2188,s=1013}\n");
   solve(example);
+  check_box_edges();
 
   Span input = Span_from_file("inputs/day19.txt");
   solve(input);
 
+  if (has_arg("--bench")) {
+    bench_memo(2000, 1000);
+    bench_jit(input);
+  }
+
   return 0;
 }
@@ -32,8 +32,242 @@ static void test_array(void) {
   assert(a.dat[6] == 127);
 }
 
+static void test_div128(void) {
+  // volatile to keep the compiler from folding the divisions
+  volatile u128 big_v = ((u128)0x123456789abcdef0 << 64) | 0x0fedcba987654321;
+  volatile u128 d_v = 0x1000000000000001;
+  u128 big = big_v;
+  u128 d = d_v;
+
+  u128 q = big / d;
+  u128 r = big % d;
+  assert(r < d);
+  assert(q * d + r == big);
+
+  assert(big / big == 1);
+  assert(big % (big + 1) == big);
+  assert((u128)42 / 5 == 8);
+
+  i128 neg = -(i128)big;
+  assert(neg / (i128)d == -(i128)q);
+  assert(neg % (i128)d == -(i128)r);
+}
+
+static void test_fmt_u128(void) {
+  u8 buf[64];
+
+  usize len = fmt_u128(buf, 64, (u128)UINT64_MAX + 1, 10);
+  Span x = {.dat = buf, .len = len};
+  assert(Span_match(&x, "18446744073709551616"));
+
+  len = fmt_u128(buf, 64, ~(u128)0, 16);
+  x = (Span){.dat = buf, .len = len};
+  assert(Span_match(&x, "FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFF"));
+}
+
+static void add_one(void *arg) { *(usize *)arg += 1; }
+
+static void local_index(void *arg) {
+  ThreadLocal *local = thread_local();
+  assert(local->self == local);
+  *(u32 *)arg = local->index;
+}
+
+static void test_threads(void) {
+  usize counts[8] = {0};
+  Thread threads[8];
+
+  for (usize i = 0; i < 8; i++) {
+    counts[i] = i;
+    Thread_spawn(&threads[i], add_one, &counts[i]);
+  }
+
+  for (usize i = 0; i < 8; i++) {
+    Thread_join(&threads[i]);
+    assert(counts[i] == i + 1);
+  }
+
+  assert(cpu_count() > 0);
+
+  // Every thread sees its own ThreadLocal, the main thread has index 0
+  assert(thread_local()->self == thread_local());
+  assert(thread_local()->index == 0);
+
+  u32 indices[8] = {0};
+  for (usize i = 0; i < 8; i++) {
+    Thread_spawn(&threads[i], local_index, &indices[i]);
+  }
+
+  for (usize i = 0; i < 8; i++) {
+    Thread_join(&threads[i]);
+    assert(indices[i] == threads[i].local.index && indices[i] > 0);
+    for (usize j = 0; j < i; j++) {
+      assert(indices[i] != indices[j]);
+    }
+  }
+
+  // Slots of joined threads are reused, however many threads were spawned
+  for (usize round = 0; round < 2 * THREAD_SLOTS; round++) {
+    Thread_spawn(&threads[0], local_index, &indices[0]);
+    Thread_join(&threads[0]);
+    assert(indices[0] == 1);
+  }
+}
+
+static void test_isqrt(void) {
+  assert(isqrt(0) == 0);
+  assert(isqrt(1) == 1);
+  assert(isqrt(3) == 1);
+  assert(isqrt(4) == 2);
+  assert(isqrt(~(u128)0) == UINT64_MAX);
+
+  // Around perfect squares, over the whole range
+  u64 state = RAND_SEED;
+  for (usize i = 0; i < 100000; i++) {
+    u64 r = rand_next(&state) >> (i % 64);
+    u128 square = (u128)r * r;
+    assert(isqrt(square) == r);
+    if (r > 0) {
+      assert(isqrt(square - 1) == r - 1);
+    }
+  }
+}
+
+static void test_matcher(void) {
+  static const char *const patterns[] = {"he", "she", "his", "hers"};
+  static Matcher matcher;
+  Matcher_init(&matcher, patterns, 4);
+
+  // Longest pattern ending at each byte
+  const char *text = "ushershis";
+  i16 expected[] = {-1, -1, -1, 1, -1, 3, -1, -1, 2};
+
+  u16 state = 0;
+  for (usize i = 0; text[i] != '\0'; i++) {
+    state = Matcher_step(&matcher, state, (u8)text[i]);
+    assert(matcher.match[state] == expected[i]);
+  }
+
+  // Bytes outside the patterns go back to the root
+  state = Matcher_step(&matcher, state, 'x');
+  assert(state == 0);
+}
+
+static void test_scan(void) {
+  Scanner scanner = Scanner_new(Span_from_str("Game 12: x=-3 y=40% ab1, cd"));
+
+  // Literal runs, %% included, are fields of their own
+  ScanFormat game = ScanFormat_new("Game %u: x=%i y=%u%%");
+  assert(game.len == 7 && game.argc == 3);
+  assert(game.fields[2].kind == SCAN_LITERAL && game.fields[2].len == 4);
+
+  u16 id;
+  i32 x;
+  u8 y;
+  bool ok = scan3(&scanner, &game, &id, &x, &y);
+  assert(ok && id == 12 && x == -3 && y == 40);
+
+  // A mismatch leaves the cursor at the start of the failing field
+  ScanFormat zz = ScanFormat_new(" zz");
+  ScanFormat space = ScanFormat_new(" ");
+  ok = scan0(&scanner, &zz);
+  assert(!ok);
+  assert(scanner.at[0] == ' ');
+  ok = scan0(&scanner, &space);
+  assert(ok);
+
+  ScanFormat word = ScanFormat_new("%w");
+  Span words[2];
+  usize len = 0;
+  do {
+    ok = scan1(&scanner, &word, &words[len]);
+    assert(ok);
+    len++;
+  } while (Scanner_more(&scanner, ", "));
+
+  assert(len == 2);
+  assert(Span_match(&words[0], "ab1") && Span_match(&words[1], "cd"));
+  assert(Scanner_done(&scanner));
+
+  scanner = Scanner_new(Span_from_str("skip: -12"));
+  ScanFormat skip = ScanFormat_new("%>:%i");
+  ScanFormat signed_int = ScanFormat_new(" %i");
+  i64 z;
+  ok = scan1(&scanner, &skip, &z);
+  assert(!ok);
+  ok = scan1(&scanner, &signed_int, &z);
+  assert(ok && z == -12);
+
+  // The extremes of each type fit, one past them is out of range
+  scanner = Scanner_new(Span_from_str(
+      "18446744073709551615 -9223372036854775808 9223372036854775807 "
+      "-128 000000000000000000000042"));
+  ScanFormat extremes = ScanFormat_new("%u %i %i %i");
+  ScanFormat unsigned_int = ScanFormat_new(" %u");
+  u64 u_max;
+  i64 i_min;
+  i64 i_max;
+  i8 i8_min;
+  u8 leading;
+  ok = scan4(&scanner, &extremes, &u_max, &i_min, &i_max, &i8_min);
+  assert(ok);
+  ok = scan1(&scanner, &unsigned_int, &leading);
+  assert(ok);
+  assert(u_max == UINT64_MAX && i_min == INT64_MIN && i_max == INT64_MAX);
+  assert(i8_min == -128 && leading == 42);
+}
+
+static void test_struct_index(void) {
+  // Longer than two blocks, and not a multiple of 64
+  Span input = Span_from_str(
+      "px{a<2006:qkq,m>2090:A,rfg}\n"
+      "pv{a>1716:R,A}\n"
+      "lnx{m>1548:A,A}\n"
+      "rfg{s<537:gd,x>2440:R,A}\n"
+      "{x=787,m=2655,a=1222,s=2876}\n"
+      "{x=1679,m=44,a=2067,s=496}\n"
+      "in{s<1351:px,qqz}");
+  StructIndex index = StructIndex_new(input, ",={}");
+
+  for (usize i = 0; i < input.len; i++) {
+    u8 c = input.dat[i];
+    const u64 *masks = index.blocks[i / 64].masks;
+    u64 bit = (u64)1 << (i % 64);
+
+    assert(((masks[STRUCT_NEWLINE] & bit) != 0) == (c == '\n'));
+    assert(((masks[STRUCT_SPACE] & bit) != 0) == (c == ' '));
+    assert(((masks[STRUCT_DIGIT] & bit) != 0) == is_digit(c, 10));
+    assert(((masks[STRUCT_CLASS] & bit) != 0) ==
+           (c == ',' || c == '=' || c == '{' || c == '}'));
+  }
+
+  // Jumping over a number
+  usize start = StructIndex_next(&index, STRUCT_DIGIT, 0, true);
+  assert(start == 5);
+  assert(StructIndex_next(&index, STRUCT_DIGIT, start, false) == 9);
+  assert(StructIndex_next(&index, STRUCT_SPACE, 0, true) == input.len);
+
+  // Walking all the newlines
+  StructIter it = StructIndex_iter(&index, STRUCT_NEWLINE);
+  usize lines = 0;
+  StructIterNext next = StructIter_next(&it);
+  while (next.valid) {
+    assert(input.dat[next.dat] == '\n');
+    lines++;
+    next = StructIter_next(&it);
+  }
+  assert(lines == 6);
+}
+
 int main(void) {
   test_array();
+  test_div128();
+  test_fmt_u128();
+  test_threads();
+  test_isqrt();
+  test_matcher();
+  test_scan();
+  test_struct_index();
   printf0("Success\n");
   return 0;
 }